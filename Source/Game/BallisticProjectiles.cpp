@@ -0,0 +1,158 @@
+#include "BallisticProjectiles.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+
+namespace tankwars {
+    BallisticProjectiles::BallisticProjectiles(const VoxelTerrain& terrain, size_t capacity, float radius,
+                                               const glm::vec3& gravity, float floorHeight)
+        : terrainRaycaster(terrain),
+          radius(radius),
+          gravity(gravity),
+          floorHeight(floorHeight),
+          projectiles(capacity) {
+        freeProjectiles.reserve(capacity);
+        activeProjectiles.reserve(capacity);
+        for (size_t i = 0; i < capacity; i++) {
+            freeProjectiles.push_back(capacity - 1 - i);
+        }
+    }
+
+    size_t BallisticProjectiles::spawn(const glm::vec3& position, const glm::vec3& velocity, int owner, void* userPointer) {
+        if (freeProjectiles.empty()) {
+            return SIZE_MAX;
+        }
+
+        auto slot = freeProjectiles.back();
+        freeProjectiles.pop_back();
+
+        auto& projectile = projectiles[slot];
+        projectile.position = position;
+        projectile.velocity = velocity;
+        projectile.owner = owner;
+        projectile.userPointer = userPointer;
+        projectile.active = true;
+        projectile.activeIndex = activeProjectiles.size();
+        activeProjectiles.push_back(slot);
+        return slot;
+    }
+
+    void BallisticProjectiles::remove(size_t slot) {
+        auto& projectile = projectiles[slot];
+        if (!projectile.active) {
+            return;
+        }
+
+        // Swap the last active projectile into the removed one's place
+        auto last = activeProjectiles.back();
+        activeProjectiles[projectile.activeIndex] = last;
+        projectiles[last].activeIndex = projectile.activeIndex;
+        activeProjectiles.pop_back();
+
+        projectile.active = false;
+        freeProjectiles.push_back(slot);
+    }
+
+    void BallisticProjectiles::update(float dt, float maxSubstep, const std::vector<ProjectileTarget>& targets,
+                                      std::vector<ProjectileImpact>& outImpacts) {
+        assert(maxSubstep > 0);
+        if (dt <= 0 || activeProjectiles.empty()) {
+            return;
+        }
+
+        // The positions are exact points of the parabola after every substep, only the path in between
+        // is approximated by the chord
+        auto numSubsteps = std::max(static_cast<int>(std::ceil(dt / maxSubstep)), 1);
+        auto substep = dt / numSubsteps;
+        auto drop = 0.5f * gravity * substep * substep;
+        for (int i = 0; i < numSubsteps && !activeProjectiles.empty(); i++) {
+            // Backwards, so removing a projectile only moves ones that already moved
+            for (auto j = activeProjectiles.size(); j-- > 0;) {
+                auto slot = activeProjectiles[j];
+                auto& projectile = projectiles[slot];
+                auto end = projectile.position + projectile.velocity * substep + drop;
+
+                int target;
+                auto fraction = sweep(projectile.position, end, targets, target);
+                if (fraction <= 1) {
+                    auto position = projectile.position + (end - projectile.position) * fraction;
+                    outImpacts.push_back({ position, projectile.owner, projectile.userPointer, target });
+                    remove(slot);
+                }
+                else {
+                    projectile.position = end;
+                    projectile.velocity += gravity * substep;
+                }
+            }
+        }
+    }
+
+    bool BallisticProjectiles::isActive(size_t slot) const {
+        return projectiles[slot].active;
+    }
+
+    const glm::vec3& BallisticProjectiles::getPosition(size_t slot) const {
+        return projectiles[slot].position;
+    }
+
+    size_t BallisticProjectiles::getNumActive() const {
+        return activeProjectiles.size();
+    }
+
+    float BallisticProjectiles::sweep(const glm::vec3& from, const glm::vec3& to,
+                                      const std::vector<ProjectileTarget>& targets, int& outTarget) {
+        auto closest = 2.0f;
+        outTarget = -1;
+
+        auto direction = to - from;
+        auto length = glm::length(direction);
+        if (length == 0) {
+            return closest;
+        }
+
+        // A target is only hit when the projectile enters it, so shells don't hit the tank they start in
+        auto a = length * length;
+        for (size_t i = 0; i < targets.size(); i++) {
+            auto offset = from - targets[i].center;
+            auto combinedRadius = targets[i].radius + radius;
+            auto b = glm::dot(offset, direction);
+            auto c = glm::dot(offset, offset) - combinedRadius * combinedRadius;
+            auto discriminant = b * b - a * c;
+            if (c <= 0 || b >= 0 || discriminant < 0) {
+                continue;
+            }
+
+            auto t = (-b - std::sqrt(discriminant)) / a;
+            if (t <= 1 && t < closest) {
+                closest = t;
+                outTarget = static_cast<int>(i);
+            }
+        }
+
+        // The sphere touches the surface when its center is one radius in front of it,
+        // so the center's segment is cast one radius further
+        auto rayEnd = to + direction * (radius / length);
+        btScalar rayFraction;
+        btVector3 normal;
+        if (terrainRaycaster.castRay(btVector3(from.x, from.y, from.z), btVector3(rayEnd.x, rayEnd.y, rayEnd.z),
+                                     rayFraction, normal)) {
+            auto t = std::max((rayFraction * (length + radius) - radius) / length, 0.0f);
+            if (t < closest) {
+                closest = t;
+                outTarget = -1;
+            }
+        }
+
+        if (to.y - radius < floorHeight && to.y < from.y) {
+            auto t = std::max((from.y - radius - floorHeight) / (from.y - to.y), 0.0f);
+            if (t < closest) {
+                closest = t;
+                outTarget = -1;
+            }
+        }
+
+        return closest;
+    }
+}
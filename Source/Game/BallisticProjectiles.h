@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "VoxelRaycaster.h"
+
+namespace tankwars {
+    class VoxelTerrain;
+
+    // A sphere the projectiles can hit besides the terrain, like a tank
+    struct ProjectileTarget {
+        glm::vec3 center;
+        float radius;
+    };
+
+    struct ProjectileImpact {
+        glm::vec3 position;     // The projectile's center when it hit
+        int owner;
+        void* userPointer;
+        int target;             // Index of the target that was hit, -1 for the terrain and the floor
+    };
+
+    // Shells that fly on closed form ballistic trajectories instead of being simulated as rigid bodies.
+    // Every substep, the chord of a shell's arc is traced through the terrain's marching cubes cells and
+    // tested against a few target spheres, so an impact needs no broadphase, narrowphase or contact callback.
+    class BallisticProjectiles {
+    public:
+        // Below floorHeight, the projectiles hit an infinite floor, like the ground plane around the map.
+        // The terrain must not move in memory while the projectiles are used.
+        BallisticProjectiles(const VoxelTerrain& terrain, size_t capacity, float radius,
+                             const glm::vec3& gravity, float floorHeight);
+
+        // Returns the projectile's slot, or SIZE_MAX if all projectiles are in flight
+        size_t spawn(const glm::vec3& position, const glm::vec3& velocity, int owner, void* userPointer);
+
+        // Removes a projectile that is still in flight
+        void remove(size_t slot);
+
+        // Advances the projectiles by dt in substeps no longer than maxSubstep. Projectiles that hit
+        // something are removed and appended to outImpacts.
+        void update(float dt, float maxSubstep, const std::vector<ProjectileTarget>& targets,
+                    std::vector<ProjectileImpact>& outImpacts);
+
+        bool isActive(size_t slot) const;
+        const glm::vec3& getPosition(size_t slot) const;
+        size_t getNumActive() const;
+
+    private:
+        struct Projectile {
+            glm::vec3 position;
+            glm::vec3 velocity;
+            int owner;
+            void* userPointer;
+            bool active = false;
+            size_t activeIndex = 0;
+        };
+
+        // Returns the fraction of the segment at which the projectile hits something, or a value
+        // above 1 if it doesn't
+        float sweep(const glm::vec3& from, const glm::vec3& to, const std::vector<ProjectileTarget>& targets,
+                    int& outTarget);
+
+        VoxelRaycaster terrainRaycaster;
+        float radius;
+        glm::vec3 gravity;
+        float floorHeight;
+
+        std::vector<Projectile> projectiles;
+        std::vector<size_t> freeProjectiles;
+        std::vector<size_t> activeProjectiles;
+    };
+}
@@ -0,0 +1,830 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "VoxelTerrain.h"
+#include "VoxelStorage.h"
+#include "MarchingCubes.h"
+#include "ChunkCollisionMesh.h"
+#include "VoxelVehicleRaycaster.h"
+#include "BallisticProjectiles.h"
+#include "CollisionEvents.h"
+#include "ParallelCollision.h"
+#include "WorkerPool.h"
+
+namespace {
+    using Clock = std::chrono::high_resolution_clock;
+
+    constexpr size_t ChunkWidth = 16;
+    constexpr size_t ChunkHeight = 8;
+    constexpr size_t ChunkDepth = 16;
+    constexpr size_t InvHeightScale = 8;
+    constexpr int NumRuns = 5;
+    constexpr size_t NumSphereEdits = 1000;
+    constexpr float SphereEditRadius = 5.0f;
+    constexpr size_t NumExplosions = 1000;
+    constexpr float ExplosionRadius = 3.5f;
+    constexpr size_t ExplosionsPerFrame = 10;
+    constexpr size_t NumWheelRayFrames = 200;
+    constexpr float WheelRayLength = 1.3f;
+    constexpr size_t MaxProjectileFrames = 600;
+    constexpr float ProjectileFrameTime = 1.0f / 60.0f;
+    constexpr float ProjectileTimeStep = 1.0f / 120.0f;
+    constexpr float ProjectileRadius = 0.1f;
+    constexpr float TargetRadius = 1.5f;
+    constexpr float GroundHeight = -1.0f;
+    constexpr short ShellCollisionFilter = 0x80; // Ballistic shells don't hit each other either
+    constexpr size_t NumPhysicsTanks = 64;
+    constexpr size_t NumPhysicsFrames = 300;
+    constexpr float PhysicsFrameTime = 1.0f / 60.0f;
+    constexpr float PhysicsTimeStep = 1.0f / 120.0f;
+
+    struct CollisionSetup {
+        tankwars::TerrainCollisionType type;
+        bool useHeightfields;
+        const char* name;
+    };
+
+    const CollisionSetup CollisionSetups[] = {
+        { tankwars::TerrainCollisionType::ChunkMeshes,     false, "chunk meshes              " },
+        { tankwars::TerrainCollisionType::ChunkMeshes,     true,  "chunk meshes, heightfields" },
+        { tankwars::TerrainCollisionType::LazyChunkMeshes, false, "lazy meshes               " },
+        { tankwars::TerrainCollisionType::LazyChunkMeshes, true,  "lazy meshes, heightfields " },
+        { tankwars::TerrainCollisionType::VoxelShape,      false, "voxel shape               " }
+    };
+
+    const char* const ShippedMaps[] = {
+        "good_level.png", "good_level2.png", "best.png", "test_big.png", "test_very_big.png", "test_very_very_big.png"
+    };
+
+    const std::pair<tankwars::VoxelStorageType, const char*> StorageTypes[] = {
+        { tankwars::VoxelStorageType::Byte,          "byte         " },
+        { tankwars::VoxelStorageType::Bit,           "bit          " },
+        { tankwars::VoxelStorageType::Bricked,       "bricked      " },
+        { tankwars::VoxelStorageType::BrickedMorton, "morton bricks" },
+        { tankwars::VoxelStorageType::Columns,       "column runs  " }
+    };
+
+    struct ShellImpact {
+        bool hit = false;
+        glm::vec3 position;
+    };
+
+    double millisecondsSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // The voxels the cells of a chunk touch
+    struct Block {
+        glm::vec3 origin;
+        size_t numCellsX, numCellsY, numCellsZ;
+        std::vector<uint8_t> voxels;
+    };
+
+    std::vector<Block> captureBlocks(const tankwars::VoxelTerrain& terrain) {
+        std::vector<Block> blocks;
+        for (size_t startZ = 0; startZ + 1 < terrain.getDepth(); startZ += ChunkDepth)
+        for (size_t startY = 0; startY + 1 < terrain.getHeight(); startY += ChunkHeight)
+        for (size_t startX = 0; startX + 1 < terrain.getWidth(); startX += ChunkWidth) {
+            Block block;
+            block.origin = glm::vec3(startX, startY, startZ);
+            block.numCellsX = std::min(startX + ChunkWidth, terrain.getWidth() - 1) - startX;
+            block.numCellsY = std::min(startY + ChunkHeight, terrain.getHeight() - 1) - startY;
+            block.numCellsZ = std::min(startZ + ChunkDepth, terrain.getDepth() - 1) - startZ;
+
+            for (size_t z = startZ; z <= startZ + block.numCellsZ; z++)
+            for (size_t y = startY; y <= startY + block.numCellsY; y++)
+            for (size_t x = startX; x <= startX + block.numCellsX; x++) {
+                block.voxels.push_back(static_cast<uint8_t>(terrain.getVoxel(x, y, z)));
+            }
+
+            blocks.push_back(std::move(block));
+        }
+
+        return blocks;
+    }
+
+    // Meshes every chunk of the map once with a grid cell per cell, the way chunks used to be meshed,
+    // and once with the slab mesher. Both have to produce exactly the same triangles.
+    void benchmarkFullMapMeshing(const tankwars::VoxelTerrain& terrain) {
+        auto blocks = captureBlocks(terrain);
+
+        tankwars::EdgeCache edgeCache;
+        std::vector<glm::vec3> cellPositions, slabPositions;
+        std::vector<uint32_t> cellIndices, slabIndices;
+        double cellTime = 1e30, slabTime = 1e30;
+        bool isIdentical = true;
+
+        for (int run = 0; run < NumRuns; run++) {
+            auto start = Clock::now();
+            for (const auto& block : blocks) {
+                cellPositions.clear();
+                cellIndices.clear();
+                edgeCache.reset(block.numCellsX, block.numCellsY, block.numCellsZ);
+
+                auto strideY = block.numCellsX + 1;
+                auto strideZ = strideY * (block.numCellsY + 1);
+                auto getVoxel = [&](size_t x, size_t y, size_t z) {
+                    return block.voxels[x + y * strideY + z * strideZ];
+                };
+
+                tankwars::GridCell gridCell;
+                for (size_t z = 0; z < block.numCellsZ; z++)
+                for (size_t y = 0; y < block.numCellsY; y++)
+                for (size_t x = 0; x < block.numCellsX; x++) {
+                    glm::vec3 position = block.origin + glm::vec3(x, y, z);
+                    gridCell.positions[0] = position + glm::vec3(0, 0, 1);
+                    gridCell.positions[1] = position + glm::vec3(1, 0, 1);
+                    gridCell.positions[2] = position + glm::vec3(1, 0, 0);
+                    gridCell.positions[3] = position;
+                    gridCell.positions[4] = position + glm::vec3(0, 1, 1);
+                    gridCell.positions[5] = position + glm::vec3(1, 1, 1);
+                    gridCell.positions[6] = position + glm::vec3(1, 1, 0);
+                    gridCell.positions[7] = position + glm::vec3(0, 1, 0);
+
+                    gridCell.values[0] = getVoxel(x,     y,     z + 1);
+                    gridCell.values[1] = getVoxel(x + 1, y,     z + 1);
+                    gridCell.values[2] = getVoxel(x + 1, y,     z);
+                    gridCell.values[3] = getVoxel(x,     y,     z);
+                    gridCell.values[4] = getVoxel(x,     y + 1, z + 1);
+                    gridCell.values[5] = getVoxel(x + 1, y + 1, z + 1);
+                    gridCell.values[6] = getVoxel(x + 1, y + 1, z);
+                    gridCell.values[7] = getVoxel(x,     y + 1, z);
+
+                    edgeCache.moveTo(x, y, z);
+                    tankwars::polygonize(gridCell, edgeCache, cellPositions, cellIndices);
+                }
+
+                if (run == 0) {
+                    slabPositions.clear();
+                    slabIndices.clear();
+                    tankwars::polygonizeBlock(block.voxels.data(), block.numCellsX, block.numCellsY, block.numCellsZ,
+                                              block.origin, edgeCache, slabPositions, slabIndices);
+                    isIdentical = isIdentical && cellPositions == slabPositions && cellIndices == slabIndices;
+                }
+            }
+            cellTime = std::min(cellTime, millisecondsSince(start));
+
+            start = Clock::now();
+            for (const auto& block : blocks) {
+                slabPositions.clear();
+                slabIndices.clear();
+                tankwars::polygonizeBlock(block.voxels.data(), block.numCellsX, block.numCellsY, block.numCellsZ,
+                                          block.origin, edgeCache, slabPositions, slabIndices);
+            }
+            slabTime = std::min(slabTime, millisecondsSince(start));
+        }
+
+        std::cout << "Full map meshing (" << blocks.size() << " chunks, single thread, best of " << NumRuns << ")\n"
+                  << "  grid cell per cell: " << cellTime << " ms\n"
+                  << "  slab mesher:        " << slabTime << " ms (" << cellTime / slabTime << "x)\n"
+                  << "  identical output:   " << (isIdentical ? "yes" : "NO") << "\n";
+    }
+
+    // Compares the voxel storage backends on the voxels of the map: memory, point reads,
+    // capturing every chunk for meshing and the bulk column operations
+    void benchmarkVoxelStorage(const tankwars::VoxelTerrain& terrain) {
+        using tankwars::VoxelStorage;
+        using tankwars::VoxelType;
+
+        auto width = terrain.getWidth();
+        auto height = terrain.getHeight();
+        auto depth = terrain.getDepth();
+
+        // A freshly loaded map is solid from the ground up to the top of every column
+        std::vector<size_t> columnHeights(width * depth, 0);
+        for (size_t z = 0; z < depth; z++)
+        for (size_t x = 0; x < width; x++) {
+            for (size_t y = height; y > 0; y--) {
+                if (terrain.getVoxel(x, y - 1, z) == VoxelType::Solid) {
+                    columnHeights[x + z * width] = y;
+                    break;
+                }
+            }
+        }
+
+        // Edits are spread evenly over the map on the surface
+        std::vector<glm::vec3> sphereCenters;
+        for (size_t i = 0; i < NumSphereEdits; i++) {
+            auto x = (i * 7919) % width;
+            auto z = (i * 104729) % depth;
+            sphereCenters.emplace_back(x, columnHeights[x + z * width], z);
+        }
+
+        std::cout << "Voxel storage (" << width << "x" << height << "x" << depth << " voxels, best of " << NumRuns << ")\n";
+        for (const auto& storageType : StorageTypes) {
+            auto storage = VoxelStorage::create(storageType.first, width, height, depth,
+                ChunkWidth, ChunkHeight, ChunkDepth);
+            double fillTime = 1e30, readTime = 1e30, captureTime = 1e30, editedCaptureTime = 1e30;
+            double sphereTime = 1e30, emptyTime = 1e30;
+            size_t numSolid = 0, numEmptyRegions = 0;
+            std::vector<uint8_t> block;
+
+            // Copies the voxels the cells of a chunk touch, like VoxelTerrain does before remeshing
+            auto captureBlock = [&](size_t startX, size_t startY, size_t startZ) {
+                auto sizeX = std::min(startX + ChunkWidth, width - 1) - startX + 1;
+                auto sizeY = std::min(startY + ChunkHeight, height - 1) - startY + 1;
+                auto sizeZ = std::min(startZ + ChunkDepth, depth - 1) - startZ + 1;
+                block.resize(sizeX * sizeY * sizeZ);
+                storage->copyBlock(startX, startY, startZ, sizeX, sizeY, sizeZ, block.data());
+            };
+
+            for (int run = 0; run < NumRuns; run++) {
+                auto start = Clock::now();
+                for (size_t z = 0; z < depth; z++)
+                for (size_t x = 0; x < width; x++) {
+                    storage->fillColumn(x, z, 0, height, VoxelType::Empty);
+                    storage->fillColumn(x, z, 0, columnHeights[x + z * width], VoxelType::Solid);
+                }
+                fillTime = std::min(fillTime, millisecondsSince(start));
+
+                start = Clock::now();
+                numSolid = 0;
+                for (size_t z = 0; z < depth; z++)
+                for (size_t y = 0; y < height; y++)
+                for (size_t x = 0; x < width; x++) {
+                    numSolid += storage->get(x, y, z) == VoxelType::Solid;
+                }
+                readTime = std::min(readTime, millisecondsSince(start));
+
+                start = Clock::now();
+                for (size_t startZ = 0; startZ + 1 < depth; startZ += ChunkDepth)
+                for (size_t startY = 0; startY + 1 < height; startY += ChunkHeight)
+                for (size_t startX = 0; startX + 1 < width; startX += ChunkWidth) {
+                    captureBlock(startX, startY, startZ);
+                }
+                captureTime = std::min(captureTime, millisecondsSince(start));
+
+                // Only the chunks around the edits, the way they are remeshed in game
+                start = Clock::now();
+                for (const auto& center : sphereCenters) {
+                    auto y = std::min(static_cast<size_t>(center.y), height - 2);
+                    captureBlock(static_cast<size_t>(center.x) / ChunkWidth * ChunkWidth, y / ChunkHeight * ChunkHeight,
+                                 static_cast<size_t>(center.z) / ChunkDepth * ChunkDepth);
+                }
+                editedCaptureTime = std::min(editedCaptureTime, millisecondsSince(start));
+
+                // The legacy per column sphere, the game carves with the stencils of benchmarkExplosionCarving
+                start = Clock::now();
+                for (const auto& center : sphereCenters) {
+                    storage->clearSphere(center, SphereEditRadius);
+                }
+                sphereTime = std::min(sphereTime, millisecondsSince(start));
+
+                // Tank sized boxes above the carved surface
+                start = Clock::now();
+                numEmptyRegions = 0;
+                for (const auto& center : sphereCenters) {
+                    auto x = static_cast<size_t>(center.x), y = static_cast<size_t>(center.y), z = static_cast<size_t>(center.z);
+                    numEmptyRegions += storage->isRegionEmpty(x, y, z, std::min(x + 4, width),
+                                                              std::min(y + 4, height), std::min(z + 4, depth));
+                }
+                emptyTime = std::min(emptyTime, millisecondsSince(start));
+            }
+
+            std::cout << "  " << storageType.second << ": " << storage->getMemoryUsage() / 1024 << " KiB"
+                      << ", fill columns " << fillTime << " ms"
+                      << ", read all " << readTime << " ms"
+                      << ", capture all chunks " << captureTime << " ms"
+                      << ", capture " << NumSphereEdits << " edited chunks " << editedCaptureTime << " ms"
+                      << ", " << NumSphereEdits << " legacy spheres " << sphereTime << " ms"
+                      << ", " << NumSphereEdits << " empty tests " << emptyTime << " ms"
+                      << " (" << numSolid << " solid, " << numEmptyRegions << " empty)\n";
+        }
+    }
+
+    // Carves explosion craters into the map, once voxel by voxel the way ExplosionHandler used to
+    // and once with the sphere stencils. Both hit the same amount of untouched surface.
+    void benchmarkExplosionCarving(const std::string& mapPath, btDiscreteDynamicsWorld* dynamicsWorld) {
+        using tankwars::VoxelType;
+
+        std::cout << "Explosion carving (" << NumExplosions << " explosions of radius " << ExplosionRadius << ")\n";
+        for (const auto& storageType : StorageTypes) {
+            auto terrain = tankwars::VoxelTerrain::fromHeightMap(mapPath, dynamicsWorld,
+                ChunkWidth, ChunkHeight, ChunkDepth, InvHeightScale, storageType.first);
+
+            // Every other explosion goes to each method, all of them on the surface
+            std::vector<glm::vec3> centers;
+            for (size_t i = 0; i < 2 * NumExplosions; i++) {
+                auto x = 4 + (i * 7919) % (terrain.getWidth() - 8);
+                auto z = 4 + (i * 104729) % (terrain.getDepth() - 8);
+                auto y = terrain.getColumnTop(x, z, terrain.getHeight());
+                centers.emplace_back(x + 0.37f, y + 0.5f, z + 0.61f);
+            }
+
+            auto start = Clock::now();
+            for (size_t i = 0; i < centers.size(); i += 2) {
+                const auto& center = centers[i];
+                int xMin = std::max((int)(center.x - ExplosionRadius), 1);
+                int yMin = std::max((int)(center.y - ExplosionRadius), 1);
+                int zMin = std::max((int)(center.z - ExplosionRadius), 1);
+                int xMax = std::min((int)(center.x + ExplosionRadius + 0.5), (int)terrain.getWidth() - 3);
+                int yMax = std::min((int)(center.y + ExplosionRadius + 0.5), (int)terrain.getHeight() - 1);
+                int zMax = std::min((int)(center.z + ExplosionRadius + 0.5), (int)terrain.getDepth() - 3);
+                for (int x = xMin; x < xMax; x++)
+                for (int y = yMin; y < yMax; y++)
+                for (int z = zMin; z < zMax; z++) {
+                    if (pow(x - center.x, 2) + pow(y - center.y, 2) + pow(z - center.z, 2) < pow(ExplosionRadius, 2)) {
+                        terrain.setVoxel(x, y, z, VoxelType::Empty);
+                    }
+                }
+            }
+            auto voxelTime = millisecondsSince(start);
+
+            tankwars::VoxelBox bounds(1, 1, 1, terrain.getWidth() - 3, terrain.getHeight() - 1, terrain.getDepth() - 3);
+            start = Clock::now();
+            for (size_t i = 1; i < centers.size(); i += 2) {
+                terrain.fillSphere(centers[i], ExplosionRadius, VoxelType::Empty, bounds);
+            }
+            auto stencilTime = millisecondsSince(start);
+
+            std::cout << "  " << storageType.second << ": voxel by voxel " << voxelTime * 1000.0 / NumExplosions
+                      << " us, sphere stencil " << stencilTime * 1000.0 / NumExplosions << " us per explosion ("
+                      << voxelTime / stencilTime << "x)\n";
+        }
+    }
+
+    // Replaces the collision geometry of a chunk with the mesh of every chunk of the shipped maps in turn.
+    // Once the way chunks used to be committed, with a new triangle mesh, BVH shape, motion state and
+    // rigid body that are removed from and added to the world, and once the way they are now, by rebuilding
+    // a reused collision mesh over the chunk's vertices and exchanging the shape of a rigid body that stays
+    // in the world.
+    void benchmarkCollisionRebuild(const std::string& mapDirectory, btDiscreteDynamicsWorld* dynamicsWorld) {
+        std::cout << "Chunk collision rebuild (per chunk with geometry, best of " << NumRuns << ")\n";
+        for (auto mapName : ShippedMaps) {
+            std::vector<Block> blocks;
+            {
+                auto terrain = tankwars::VoxelTerrain::fromHeightMap(mapDirectory + mapName, dynamicsWorld,
+                    ChunkWidth, ChunkHeight, ChunkDepth, InvHeightScale, tankwars::VoxelStorageType::Columns);
+                blocks = captureBlocks(terrain);
+            }
+
+            struct ChunkMesh {
+                std::vector<glm::vec3> positions;
+                std::vector<tankwars::Vertex> vertices;
+                std::vector<uint32_t> indices;
+            };
+
+            std::vector<ChunkMesh> meshes;
+            tankwars::EdgeCache edgeCache;
+            for (const auto& block : blocks) {
+                ChunkMesh mesh;
+                tankwars::polygonizeBlock(block.voxels.data(), block.numCellsX, block.numCellsY, block.numCellsZ,
+                                          block.origin, edgeCache, mesh.positions, mesh.indices);
+                if (!mesh.indices.empty()) {
+                    for (const auto& position : mesh.positions) {
+                        mesh.vertices.push_back({ position, glm::vec3(0, 1, 0) });
+                    }
+
+                    meshes.push_back(std::move(mesh));
+                }
+            }
+
+            if (meshes.empty()) {
+                continue;
+            }
+
+            double recreateTime = 1e30, rebuildTime = 1e30;
+            for (int run = 0; run < NumRuns; run++) {
+                std::unique_ptr<btTriangleMesh> triangleMesh;
+                std::unique_ptr<btBvhTriangleMeshShape> shape;
+                std::unique_ptr<btDefaultMotionState> motionState;
+                std::unique_ptr<btRigidBody> rigidBody;
+
+                auto start = Clock::now();
+                for (const auto& mesh : meshes) {
+                    if (rigidBody) {
+                        dynamicsWorld->removeRigidBody(rigidBody.get());
+                        rigidBody.reset();
+                    }
+
+                    triangleMesh.reset(new btTriangleMesh);
+                    triangleMesh->preallocateVertices(static_cast<int>(mesh.indices.size() / 3));
+                    triangleMesh->preallocateIndices(static_cast<int>(mesh.indices.size()));
+                    for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+                        const auto& pos1 = mesh.positions[mesh.indices[i]];
+                        const auto& pos2 = mesh.positions[mesh.indices[i + 1]];
+                        const auto& pos3 = mesh.positions[mesh.indices[i + 2]];
+                        triangleMesh->addTriangle(btVector3(pos1.x, pos1.y, pos1.z),
+                            btVector3(pos2.x, pos2.y, pos2.z), btVector3(pos3.x, pos3.y, pos3.z));
+                    }
+
+                    shape.reset(new btBvhTriangleMeshShape(triangleMesh.get(), true));
+                    motionState.reset(new btDefaultMotionState(btTransform(btQuaternion(0, 0, 0, 1), btVector3(0, 0, 0))));
+                    btRigidBody::btRigidBodyConstructionInfo rigidBodyCI(0, motionState.get(), shape.get(), btVector3(0, 0, 0));
+                    rigidBody.reset(new btRigidBody(rigidBodyCI));
+                    dynamicsWorld->addRigidBody(rigidBody.get());
+                }
+                recreateTime = std::min(recreateTime, millisecondsSince(start));
+                dynamicsWorld->removeRigidBody(rigidBody.get());
+                rigidBody.reset();
+
+                std::unique_ptr<tankwars::ChunkCollisionMesh> frontMesh(new tankwars::ChunkCollisionMesh);
+                std::unique_ptr<tankwars::ChunkCollisionMesh> backMesh(new tankwars::ChunkCollisionMesh);
+                frontMesh->rebuild(meshes[0].vertices, meshes[0].indices);
+                btRigidBody::btRigidBodyConstructionInfo rigidBodyCI(0, nullptr, frontMesh->getShape(), btVector3(0, 0, 0));
+                rigidBody.reset(new btRigidBody(rigidBodyCI));
+                dynamicsWorld->addRigidBody(rigidBody.get());
+
+                start = Clock::now();
+                for (const auto& mesh : meshes) {
+                    backMesh->rebuild(mesh.vertices, mesh.indices);
+                    std::swap(frontMesh, backMesh);
+                    rigidBody->setCollisionShape(frontMesh->getShape());
+                    dynamicsWorld->getBroadphase()->getOverlappingPairCache()->cleanProxyFromPairs(
+                        rigidBody->getBroadphaseHandle(), dynamicsWorld->getDispatcher());
+                    dynamicsWorld->updateSingleAabb(rigidBody.get());
+                }
+                rebuildTime = std::min(rebuildTime, millisecondsSince(start));
+                dynamicsWorld->removeRigidBody(rigidBody.get());
+            }
+
+            std::cout << "  " << mapName << " (" << meshes.size() << " chunks): recreate "
+                      << recreateTime * 1000.0 / meshes.size() << " us, rebuild in place "
+                      << rebuildTime * 1000.0 / meshes.size() << " us (" << recreateTime / rebuildTime << "x)\n";
+        }
+    }
+
+    // Compares the terrain collision types: setting up the collision of a freshly loaded map with two
+    // tank sized bodies on it, wheel-like rays straight down and carving explosion craters frame by frame,
+    // including the remeshes. Lazy chunk meshes only collide near the two bodies.
+    void benchmarkTerrainCollision(const std::string& mapPath, btDiscreteDynamicsWorld* dynamicsWorld) {
+        using tankwars::VoxelType;
+
+        std::cout << "Terrain collision (" << NumExplosions << " explosions in frames of " << ExplosionsPerFrame << ")\n";
+        btBoxShape tankShape(btVector3(1.0f, 0.5f, 1.5f));
+        for (const auto& collisionSetup : CollisionSetups) {
+            auto start = Clock::now();
+            auto terrain = tankwars::VoxelTerrain::fromHeightMap(mapPath, dynamicsWorld,
+                ChunkWidth, ChunkHeight, ChunkDepth, InvHeightScale, tankwars::VoxelStorageType::Bricked,
+                collisionSetup.type, collisionSetup.useHeightfields);
+
+            std::vector<std::unique_ptr<btRigidBody>> tanks;
+            for (auto position : { glm::vec2(0.25f, 0.25f), glm::vec2(0.75f, 0.75f) }) {
+                auto x = static_cast<size_t>(position.x * terrain.getWidth());
+                auto z = static_cast<size_t>(position.y * terrain.getDepth());
+                btTransform transform(btQuaternion::getIdentity(),
+                    btVector3(static_cast<btScalar>(x), terrain.getColumnTop(x, z, terrain.getHeight()) + 1.5f, -btScalar(z)));
+                btRigidBody::btRigidBodyConstructionInfo tankCI(1, nullptr, &tankShape);
+                tankCI.m_startWorldTransform = transform;
+                tanks.emplace_back(new btRigidBody(tankCI));
+                dynamicsWorld->addRigidBody(tanks.back().get());
+            }
+
+            terrain.updateMesh();
+            auto loadTime = millisecondsSince(start);
+            auto numLoadChunks = terrain.getNumCollisionChunks();
+            auto numLoadColumns = terrain.getNumHeightfieldColumns();
+            auto loadMemory = terrain.getCollisionMemoryUsage();
+
+            start = Clock::now();
+            size_t numRays = 0, numHits = 0;
+            for (float z = 0.5f; z < terrain.getDepth() - 1; z += 1.37f)
+            for (float x = 0.5f; x < terrain.getWidth() - 1; x += 1.37f, numRays++) {
+                btVector3 from(x, static_cast<btScalar>(terrain.getHeight()), -z);
+                btVector3 to(x, 0, -z);
+                btCollisionWorld::ClosestRayResultCallback result(from, to);
+                dynamicsWorld->rayTest(from, to, result);
+                numHits += result.hasHit();
+            }
+            auto rayTime = millisecondsSince(start);
+
+            tankwars::VoxelBox bounds(1, 1, 1, terrain.getWidth() - 3, terrain.getHeight() - 1, terrain.getDepth() - 3);
+            std::vector<glm::vec3> centers;
+            start = Clock::now();
+            for (size_t i = 0; i < NumExplosions; i++) {
+                auto x = 4 + (i * 7919) % (terrain.getWidth() - 8);
+                auto z = 4 + (i * 104729) % (terrain.getDepth() - 8);
+                centers.emplace_back(x + 0.37f, terrain.getColumnTop(x, z, terrain.getHeight()) + 0.5f, z + 0.61f);
+                if (centers.size() == ExplosionsPerFrame) {
+                    terrain.fillSpheres(centers, ExplosionRadius, VoxelType::Empty, bounds);
+                    terrain.updateMesh();
+                    centers.clear();
+                }
+            }
+            auto carveTime = millisecondsSince(start);
+
+            std::cout << "  " << collisionSetup.name << ": load " << loadTime << " ms, "
+                      << numRays << " rays " << rayTime << " ms (" << numHits << " hits), carving "
+                      << carveTime * 1000.0 / NumExplosions << " us per explosion\n"
+                      << "    collision after load: " << numLoadChunks << " chunks, " << numLoadColumns
+                      << " heightfields, " << loadMemory / 1024 << " KiB, after carving: "
+                      << terrain.getNumCollisionChunks() << " chunks, " << terrain.getNumHeightfieldColumns()
+                      << " heightfields, " << terrain.getCollisionMemoryUsage() / 1024 << " KiB\n";
+
+            for (auto& tank : tanks) {
+                dynamicsWorld->removeRigidBody(tank.get());
+            }
+        }
+    }
+
+    // Compares the wheel rays of btDefaultVehicleRaycaster against the chunk meshes with the
+    // voxel raycaster, for a few numbers of tanks with four wheels each. Every ray starts one
+    // voxel above the surface, like the wheels of a tank standing on the ground.
+    void benchmarkWheelRays(const std::string& mapPath, btDiscreteDynamicsWorld* dynamicsWorld) {
+        std::cout << "Wheel rays (" << NumWheelRayFrames << " frames, chunk meshes)\n";
+        auto terrain = tankwars::VoxelTerrain::fromHeightMap(mapPath, dynamicsWorld,
+            ChunkWidth, ChunkHeight, ChunkDepth, InvHeightScale, tankwars::VoxelStorageType::Bricked,
+            tankwars::TerrainCollisionType::ChunkMeshes, false);
+
+        btDefaultVehicleRaycaster defaultRaycaster(dynamicsWorld);
+        tankwars::VoxelVehicleRaycaster voxelRaycaster(terrain, dynamicsWorld);
+        const btVector3 wheelOffsets[] = {
+            btVector3(-1.5f, 0, 1.8f), btVector3(1.5f, 0, 1.8f), btVector3(-1.5f, 0, -1.8f), btVector3(1.5f, 0, -1.8f)
+        };
+
+        for (size_t numTanks : { 1, 8, 64 }) {
+            std::vector<std::pair<btVector3, btVector3>> rays;
+            for (size_t i = 0; i < numTanks; i++) {
+                auto tankX = 4 + (i * 7919) % (terrain.getWidth() - 8);
+                auto tankZ = 4 + (i * 104729) % (terrain.getDepth() - 8);
+                for (const auto& offset : wheelOffsets) {
+                    auto x = tankX + offset.x() + 0.37f;
+                    auto z = tankZ + offset.z() + 0.61f;
+                    auto top = terrain.getColumnTop(static_cast<size_t>(x), static_cast<size_t>(z), terrain.getHeight());
+                    btVector3 from(x, top + 1.0f, -z);
+                    rays.emplace_back(from, from - btVector3(0, WheelRayLength, 0));
+                }
+            }
+
+            btVehicleRaycaster::btVehicleRaycasterResult defaultResult, voxelResult;
+            size_t numMismatches = 0;
+            btScalar maxFractionDifference = 0;
+            for (const auto& ray : rays) {
+                auto defaultHit = defaultRaycaster.castRay(ray.first, ray.second, defaultResult) != nullptr;
+                auto voxelHit = voxelRaycaster.castRay(ray.first, ray.second, voxelResult) != nullptr;
+                if (defaultHit != voxelHit) {
+                    numMismatches++;
+                }
+                else if (defaultHit) {
+                    maxFractionDifference = std::max(maxFractionDifference,
+                        std::abs(defaultResult.m_distFraction - voxelResult.m_distFraction));
+                }
+            }
+
+            double defaultTime = 1e30, voxelTime = 1e30;
+            for (int run = 0; run < NumRuns; run++) {
+                auto start = Clock::now();
+                for (size_t frame = 0; frame < NumWheelRayFrames; frame++) {
+                    for (const auto& ray : rays) {
+                        defaultRaycaster.castRay(ray.first, ray.second, defaultResult);
+                    }
+                }
+                defaultTime = std::min(defaultTime, millisecondsSince(start));
+
+                start = Clock::now();
+                for (size_t frame = 0; frame < NumWheelRayFrames; frame++) {
+                    for (const auto& ray : rays) {
+                        voxelRaycaster.castRay(ray.first, ray.second, voxelResult);
+                    }
+                }
+                voxelTime = std::min(voxelTime, millisecondsSince(start));
+            }
+
+            auto numCasts = static_cast<double>(rays.size() * NumWheelRayFrames);
+            std::cout << "  " << numTanks << " tanks: default " << defaultTime * 1000.0 / numCasts
+                      << " us per ray, voxels " << voxelTime * 1000.0 / numCasts << " us per ray ("
+                      << defaultTime / voxelTime << "x), " << numMismatches << " of " << rays.size()
+                      << " hits differ, max fraction difference " << maxFractionDifference << "\n";
+        }
+    }
+
+    // Fires the same volleys of shells as CCD rigid bodies, pooled like the tanks' bullets, and as ballistic
+    // projectiles, and measures the frames until all of them hit something. The terrain uses the game's lazy
+    // collision, which builds chunk meshes around the rigid bodies. Two tank sized spheres are targets too.
+    void benchmarkProjectiles(const std::string& mapPath, btDiscreteDynamicsWorld* dynamicsWorld) {
+        std::cout << "Projectiles (at most " << MaxProjectileFrames << " frames, lazy chunk meshes)\n";
+        auto terrain = tankwars::VoxelTerrain::fromHeightMap(mapPath, dynamicsWorld,
+            ChunkWidth, ChunkHeight, ChunkDepth, InvHeightScale, tankwars::VoxelStorageType::Bricked,
+            tankwars::TerrainCollisionType::LazyChunkMeshes);
+        terrain.updateMesh();
+
+        btStaticPlaneShape groundShape(btVector3(0, 1, 0), GroundHeight);
+        btRigidBody ground(0, nullptr, &groundShape);
+        dynamicsWorld->addRigidBody(&ground);
+
+        btSphereShape targetShape(TargetRadius);
+        std::vector<std::unique_ptr<btRigidBody>> targetBodies;
+        std::vector<tankwars::ProjectileTarget> targets;
+        for (auto position : { glm::vec2(0.25f, 0.25f), glm::vec2(0.75f, 0.75f) }) {
+            auto x = static_cast<size_t>(position.x * terrain.getWidth());
+            auto z = static_cast<size_t>(position.y * terrain.getDepth());
+            glm::vec3 center(x, terrain.getColumnTop(x, z, terrain.getHeight()) + TargetRadius, -btScalar(z));
+            targets.push_back({ center, TargetRadius });
+
+            btRigidBody::btRigidBodyConstructionInfo targetCI(0, nullptr, &targetShape);
+            targetCI.m_startWorldTransform.setOrigin(btVector3(center.x, center.y, center.z));
+            targetBodies.emplace_back(new btRigidBody(targetCI));
+            dynamicsWorld->addRigidBody(targetBodies.back().get());
+        }
+
+        auto gravity = dynamicsWorld->getGravity();
+        // Records where a shell's center was at its first contact
+        tankwars::CollisionEventDispatcher collisionEvents(dynamicsWorld, 4000);
+        collisionEvents.setHandler(tankwars::CollisionCategory::Bullet, [](const tankwars::CollisionEvent& event) {
+            auto impact = static_cast<ShellImpact*>(event.object->getUserPointer());
+            if (!impact->hit) {
+                auto center = event.position + event.normal * ProjectileRadius;
+                impact->hit = true;
+                impact->position = glm::vec3(center.x(), center.y(), center.z());
+            }
+        });
+
+        btSphereShape shellShape(ProjectileRadius);
+        for (size_t numShells : { 100, 1000, 4000 }) {
+            // Volleys from above the terrain in all directions, some of them leave the map
+            std::vector<std::pair<glm::vec3, glm::vec3>> shells;
+            for (size_t i = 0; i < numShells; i++) {
+                auto x = 4 + (i * 7919) % (terrain.getWidth() - 8);
+                auto z = 4 + (i * 104729) % (terrain.getDepth() - 8);
+                auto angle = i * 2.4f;
+                auto speed = 10.0f + i % 20;
+                glm::vec3 position(x + 0.37f, terrain.getColumnTop(x, z, terrain.getHeight()) + 3.0f + i % 10, -(z + 0.61f));
+                glm::vec3 velocity(std::cos(angle) * speed, 2.0f + i % 7, std::sin(angle) * speed);
+                shells.emplace_back(position, velocity);
+            }
+
+            std::vector<ShellImpact> bodyImpacts(numShells);
+            std::vector<std::unique_ptr<btRigidBody>> bodies;
+            for (size_t i = 0; i < numShells; i++) {
+                btRigidBody::btRigidBodyConstructionInfo shellCI(20, nullptr, &shellShape);
+                const auto& shell = shells[i];
+                shellCI.m_startWorldTransform.setOrigin(btVector3(shell.first.x, shell.first.y, shell.first.z));
+                bodies.emplace_back(new btRigidBody(shellCI));
+                auto body = bodies.back().get();
+                body->setLinearVelocity(btVector3(shell.second.x, shell.second.y, shell.second.z));
+                tankwars::setCollisionCategory(*body, tankwars::CollisionCategory::Bullet);
+                body->setUserPointer(&bodyImpacts[i]);
+                body->setCcdMotionThreshold(0.2f);
+                body->setCcdSweptSphereRadius(ProjectileRadius);
+                dynamicsWorld->addRigidBody(body, ShellCollisionFilter, btBroadphaseProxy::AllFilter ^ ShellCollisionFilter);
+            }
+
+            // Shells that hit something are parked like the pooled bullets
+            auto start = Clock::now();
+            size_t numBodyFrames = 0;
+            size_t numFlying = numShells;
+            for (; numBodyFrames < MaxProjectileFrames && numFlying > 0; numBodyFrames++) {
+                terrain.updateMesh();
+                dynamicsWorld->stepSimulation(ProjectileFrameTime, 2, ProjectileTimeStep);
+                collisionEvents.dispatch();
+                for (size_t i = 0; i < numShells; i++) {
+                    auto body = bodies[i].get();
+                    if (bodyImpacts[i].hit && body->getActivationState() != DISABLE_SIMULATION) {
+                        body->forceActivationState(DISABLE_SIMULATION);
+                        body->getBroadphaseHandle()->m_collisionFilterMask = 0;
+                        dynamicsWorld->getBroadphase()->getOverlappingPairCache()->removeOverlappingPairsContainingProxy(
+                            body->getBroadphaseHandle(), dynamicsWorld->getDispatcher());
+                        numFlying--;
+                    }
+                }
+            }
+            auto bodyTime = millisecondsSince(start);
+
+            for (auto& body : bodies) {
+                dynamicsWorld->removeRigidBody(body.get());
+            }
+
+            std::vector<ShellImpact> ballisticImpacts(numShells);
+            std::vector<tankwars::ProjectileImpact> impacts;
+            start = Clock::now();
+            tankwars::BallisticProjectiles projectiles(terrain, numShells, ProjectileRadius,
+                glm::vec3(gravity.x(), gravity.y(), gravity.z()), GroundHeight);
+            for (size_t i = 0; i < numShells; i++) {
+                projectiles.spawn(shells[i].first, shells[i].second, 0, &ballisticImpacts[i]);
+            }
+
+            size_t numBallisticFrames = 0;
+            for (; numBallisticFrames < MaxProjectileFrames && projectiles.getNumActive() > 0; numBallisticFrames++) {
+                impacts.clear();
+                projectiles.update(ProjectileFrameTime, ProjectileTimeStep, targets, impacts);
+                for (const auto& impact : impacts) {
+                    auto shellImpact = static_cast<ShellImpact*>(impact.userPointer);
+                    shellImpact->hit = true;
+                    shellImpact->position = impact.position;
+                }
+            }
+            auto ballisticTime = millisecondsSince(start);
+
+            // Chaotic bounces aside, both should hit the same spots
+            size_t numBodyHits = 0, numBallisticHits = 0, numClose = 0;
+            for (size_t i = 0; i < numShells; i++) {
+                numBodyHits += bodyImpacts[i].hit;
+                numBallisticHits += ballisticImpacts[i].hit;
+                if (bodyImpacts[i].hit && ballisticImpacts[i].hit &&
+                    glm::length(bodyImpacts[i].position - ballisticImpacts[i].position) < 0.5f) {
+                    numClose++;
+                }
+            }
+
+            std::cout << "  " << numShells << " shells: rigid bodies " << bodyTime << " ms for " << numBodyFrames
+                      << " frames (" << numBodyHits << " hits), ballistic " << ballisticTime << " ms for "
+                      << numBallisticFrames << " frames (" << numBallisticHits << " hits), "
+                      << bodyTime / ballisticTime << "x, " << numClose << " impacts within 0.5\n";
+        }
+
+        for (auto& target : targetBodies) {
+            dynamicsWorld->removeRigidBody(target.get());
+        }
+
+        dynamicsWorld->removeRigidBody(&ground);
+    }
+    // Drops tank shaped bodies onto the map and measures the physics steps while they land and settle,
+    // with the narrowphase on different numbers of worker threads. Each thread count gets its own world
+    // with the game's lazy chunk collision.
+    void benchmarkPhysicsThreads(const std::string& mapPath) {
+        std::cout << "Physics threads (" << NumPhysicsTanks << " tanks, " << NumPhysicsFrames << " frames)\n";
+        btBoxShape tankBoxShape(btVector3(1.5f, 0.3f, 2.0f));
+        btCompoundShape tankShape;
+        tankShape.addChildShape(btTransform(btQuaternion::getIdentity(), btVector3(0, 0.5f, 0)), &tankBoxShape);
+        btVector3 tankInertia;
+        tankShape.calculateLocalInertia(1, tankInertia);
+
+        std::vector<size_t> threadCounts = { 0, 1, 3 };
+        if (tankwars::WorkerPool::getDefaultThreadCount() > 3) {
+            threadCounts.push_back(tankwars::WorkerPool::getDefaultThreadCount());
+        }
+
+        double serialTime = 0;
+        for (auto numThreads : threadCounts) {
+            tankwars::WorkerPool workerPool(numThreads);
+            btDbvtBroadphase broadphase;
+            tankwars::ParallelCollisionConfiguration collisionConfiguration;
+            tankwars::ParallelCollisionDispatcher dispatcher(&collisionConfiguration, workerPool);
+            btSequentialImpulseConstraintSolver solver;
+            btDiscreteDynamicsWorld dynamicsWorld(&dispatcher, &broadphase, &solver, &collisionConfiguration);
+
+            {
+                auto terrain = tankwars::VoxelTerrain::fromHeightMap(mapPath, &dynamicsWorld,
+                    ChunkWidth, ChunkHeight, ChunkDepth, InvHeightScale, tankwars::VoxelStorageType::Bricked,
+                    tankwars::TerrainCollisionType::LazyChunkMeshes);
+
+                // A grid over the whole map, so the tanks touch many different chunks
+                std::vector<std::unique_ptr<btRigidBody>> tanks;
+                auto gridSize = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(NumPhysicsTanks))));
+                for (size_t i = 0; i < NumPhysicsTanks; i++) {
+                    auto x = (2 * (i % gridSize) + 1) * terrain.getWidth() / (2 * gridSize);
+                    auto z = (2 * (i / gridSize) + 1) * terrain.getDepth() / (2 * gridSize);
+                    btRigidBody::btRigidBodyConstructionInfo tankCI(1, nullptr, &tankShape, tankInertia);
+                    tankCI.m_startWorldTransform.setOrigin(btVector3(static_cast<btScalar>(x),
+                        terrain.getColumnTop(x, z, terrain.getHeight()) + 2.0f, -btScalar(z)));
+                    tanks.emplace_back(new btRigidBody(tankCI));
+                    tanks.back()->setActivationState(DISABLE_DEACTIVATION);
+                    dynamicsWorld.addRigidBody(tanks.back().get());
+                }
+
+                double stepTime = 0;
+                for (size_t frame = 0; frame < NumPhysicsFrames; frame++) {
+                    terrain.updateMesh();
+                    auto start = Clock::now();
+                    dynamicsWorld.stepSimulation(PhysicsFrameTime, 2, PhysicsTimeStep);
+                    stepTime += millisecondsSince(start);
+                }
+
+                if (numThreads == 0) {
+                    serialTime = stepTime;
+                }
+
+                // The contacts are solved in a different order with threads, so the tanks end up in
+                // slightly different places
+                auto numManifolds = dispatcher.getNumManifolds();
+                double averageHeight = 0;
+                for (auto& tank : tanks) {
+                    averageHeight += tank->getWorldTransform().getOrigin().y() / NumPhysicsTanks;
+                    dynamicsWorld.removeRigidBody(tank.get());
+                }
+
+                std::cout << "  " << numThreads << " worker threads: " << stepTime / NumPhysicsFrames
+                          << " ms per frame (" << serialTime / stepTime << "x), " << numManifolds
+                          << " manifolds, average tank height " << averageHeight << "\n";
+            }
+        }
+    }
+}
+
+namespace tankwars {
+    void runBenchmarks(const std::string& mapPath, btDiscreteDynamicsWorld* dynamicsWorld) {
+        std::cout << "Map: " << mapPath << "\n";
+
+        // The terrain's collision must be gone before the collision benchmarks add their own
+        {
+            auto terrain = VoxelTerrain::fromHeightMap(mapPath, dynamicsWorld,
+                ChunkWidth, ChunkHeight, ChunkDepth, InvHeightScale);
+
+            benchmarkFullMapMeshing(terrain);
+            benchmarkVoxelStorage(terrain);
+        }
+
+        benchmarkExplosionCarving(mapPath, dynamicsWorld);
+        benchmarkTerrainCollision(mapPath, dynamicsWorld);
+        benchmarkWheelRays(mapPath, dynamicsWorld);
+        benchmarkProjectiles(mapPath, dynamicsWorld);
+        benchmarkPhysicsThreads(mapPath);
+        benchmarkCollisionRebuild(mapPath.substr(0, mapPath.find_last_of('/') + 1), dynamicsWorld);
+    }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+
+#include <btBulletDynamicsCommon.h>
+
+namespace tankwars {
+    // Runs the performance measurements and prints the results instead of starting the game.
+    //   Needs a current GL context, since the terrain uploads its meshes.
+    void runBenchmarks(const std::string& mapPath, btDiscreteDynamicsWorld* dynamicsWorld);
+}
@@ -0,0 +1,117 @@
+#include "ChunkCollisionMesh.h"
+
+#include <cstddef>
+
+namespace tankwars {
+    // Lets Bullet read the positions straight out of the chunk's vertices
+    class ChunkCollisionMesh::TriangleMesh : public btTriangleIndexVertexArray {
+    public:
+        TriangleMesh() {
+            btIndexedMesh mesh;
+            mesh.m_numTriangles = 0;
+            mesh.m_triangleIndexBase = nullptr;
+            mesh.m_triangleIndexStride = 3 * sizeof(uint32_t);
+            mesh.m_numVertices = 0;
+            mesh.m_vertexBase = nullptr;
+            mesh.m_vertexStride = sizeof(Vertex);
+            mesh.m_vertexType = PHY_FLOAT;
+            addIndexedMesh(mesh, PHY_INTEGER);
+        }
+
+        void assign(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
+            static_assert(offsetof(Vertex, position) == 0, "Bullet expects the position at the start of a vertex");
+
+            auto& mesh = m_indexedMeshes[0];
+            mesh.m_vertexBase = reinterpret_cast<const unsigned char*>(vertices.data());
+            mesh.m_numVertices = static_cast<int>(vertices.size());
+            mesh.m_triangleIndexBase = reinterpret_cast<const unsigned char*>(indices.data());
+            mesh.m_numTriangles = static_cast<int>(indices.size() / 3);
+        }
+
+        int getNumTriangles() const {
+            return m_indexedMeshes[0].m_numTriangles;
+        }
+    };
+
+    // btOptimizedBvh::build() appends to the subtree headers, so they are cleared before a rebuild.
+    // The node arrays are only resized and keep their memory, except for the leaf nodes, which build()
+    // frees at the end. They are collected in a buffer of the Bvh instead, which build() doesn't own.
+    class ChunkCollisionMesh::Bvh : public btOptimizedBvh {
+    public:
+        void rebuild(btStridingMeshInterface* triangles, int numTriangles,
+                     const btVector3& aabbMin, const btVector3& aabbMax) {
+            // One leaf per triangle, so build() never has to grow the buffer
+            if (leafNodeBuffer.size() < numTriangles) {
+                leafNodeBuffer.resize(numTriangles);
+            }
+
+            m_quantizedLeafNodes.initializeFromBuffer(&leafNodeBuffer[0], 0, leafNodeBuffer.size());
+            m_SubtreeHeaders.resize(0);
+            build(triangles, true, aabbMin, aabbMax);
+        }
+
+        size_t getMemoryUsage() const {
+            return sizeof(*this) +
+                m_leafNodes.capacity() * sizeof(btOptimizedBvhNode) +
+                m_contiguousNodes.capacity() * sizeof(btOptimizedBvhNode) +
+                leafNodeBuffer.capacity() * sizeof(btQuantizedBvhNode) +
+                m_quantizedContiguousNodes.capacity() * sizeof(btQuantizedBvhNode) +
+                m_SubtreeHeaders.capacity() * sizeof(btBvhSubtreeInfo);
+        }
+
+    private:
+        btAlignedObjectArray<btQuantizedBvhNode> leafNodeBuffer;
+    };
+
+    // Takes the bounds from the vertices instead of six support queries over every triangle
+    class ChunkCollisionMesh::Shape : public btBvhTriangleMeshShape {
+    public:
+        explicit Shape(btStridingMeshInterface* triangles)
+            : btBvhTriangleMeshShape(triangles, true, false) {
+        }
+
+        void setLocalAabb(const btVector3& aabbMin, const btVector3& aabbMax) {
+            m_localAabbMin = aabbMin;
+            m_localAabbMax = aabbMax;
+        }
+    };
+
+    ChunkCollisionMesh::ChunkCollisionMesh()
+        : triangleMesh(new TriangleMesh),
+          bvh(new Bvh) {
+    }
+
+    ChunkCollisionMesh::~ChunkCollisionMesh() = default;
+
+    void ChunkCollisionMesh::rebuild(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
+        triangleMesh->assign(vertices, indices);
+
+        btVector3 aabbMin(BT_LARGE_FLOAT, BT_LARGE_FLOAT, BT_LARGE_FLOAT);
+        btVector3 aabbMax(-BT_LARGE_FLOAT, -BT_LARGE_FLOAT, -BT_LARGE_FLOAT);
+        for (const auto& vertex : vertices) {
+            btVector3 position(vertex.position.x, vertex.position.y, vertex.position.z);
+            aabbMin.setMin(position);
+            aabbMax.setMax(position);
+        }
+
+        if (!shape) {
+            shape.reset(new Shape(triangleMesh.get()));
+            shape->setOptimizedBvh(bvh.get());
+        }
+
+        shape->setLocalAabb(aabbMin, aabbMax);
+        bvh->rebuild(triangleMesh.get(), triangleMesh->getNumTriangles(), aabbMin, aabbMax);
+    }
+
+    btBvhTriangleMeshShape* ChunkCollisionMesh::getShape() const {
+        return shape.get();
+    }
+
+    size_t ChunkCollisionMesh::getNumTriangles() const {
+        return static_cast<size_t>(triangleMesh->getNumTriangles());
+    }
+
+    size_t ChunkCollisionMesh::getMemoryUsage() const {
+        return sizeof(*this) + sizeof(TriangleMesh) + bvh->getMemoryUsage() + (shape ? sizeof(Shape) : 0);
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <btBulletCollisionCommon.h>
+#include <glm/glm.hpp>
+
+#include "Vertex.h"
+
+namespace tankwars {
+    // The collision geometry of a terrain chunk. It uses the chunk's vertex and index arrays in place,
+    // and rebuilding it reuses the BVH and the shape, so remeshing a chunk again and again doesn't allocate.
+    class ChunkCollisionMesh {
+    public:
+        ChunkCollisionMesh();
+        ChunkCollisionMesh(const ChunkCollisionMesh&) = delete;
+        ~ChunkCollisionMesh();
+        ChunkCollisionMesh& operator=(const ChunkCollisionMesh&) = delete;
+
+        // Rebuilds the BVH over the triangles of the arrays, which must not be empty. The arrays are
+        // referenced, not copied, so their memory must stay where it is as long as the shape is used.
+        // The shape must not be used by the dynamics world during the rebuild.
+        void rebuild(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+
+        // Null until the first rebuild
+        btBvhTriangleMeshShape* getShape() const;
+
+        size_t getNumTriangles() const;
+
+        // Bytes used by the BVH and the shape, without the referenced arrays
+        size_t getMemoryUsage() const;
+
+    private:
+        class TriangleMesh;
+        class Bvh;
+        class Shape;
+
+        std::unique_ptr<TriangleMesh> triangleMesh;
+        std::unique_ptr<Bvh> bvh;
+        std::unique_ptr<Shape> shape;
+    };
+}
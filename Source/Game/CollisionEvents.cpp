@@ -0,0 +1,87 @@
+#include "CollisionEvents.h"
+
+#include <cassert>
+
+namespace tankwars {
+    void setCollisionCategory(btCollisionObject& object, CollisionCategory category) {
+        object.setUserIndex(static_cast<int>(category));
+    }
+
+    CollisionCategory getCollisionCategory(const btCollisionObject& object) {
+        // Objects nobody categorized have Bullet's default user index of -1
+        auto index = object.getUserIndex();
+        if (index <= 0 || index >= static_cast<int>(CollisionCategory::Count)) {
+            return CollisionCategory::None;
+        }
+
+        return static_cast<CollisionCategory>(index);
+    }
+
+    CollisionEventDispatcher::CollisionEventDispatcher(btDynamicsWorld* dynamicsWorld, size_t eventCapacity)
+        : dynamicsWorld(dynamicsWorld) {
+        assert(!dynamicsWorld->getWorldUserInfo());
+        events.reserve(eventCapacity);
+        dynamicsWorld->setInternalTickCallback(internalTickCallback, this);
+    }
+
+    CollisionEventDispatcher::~CollisionEventDispatcher() {
+        dynamicsWorld->setInternalTickCallback(nullptr);
+    }
+
+    void CollisionEventDispatcher::setHandler(CollisionCategory category,
+                                              std::function<void(const CollisionEvent&)> handler) {
+        assert(category != CollisionCategory::None && category != CollisionCategory::Count);
+        handlers[static_cast<size_t>(category)] = std::move(handler);
+    }
+
+    void CollisionEventDispatcher::dispatch() {
+        for (const auto& event : events) {
+            handlers[static_cast<size_t>(event.category)](event);
+        }
+
+        events.clear();
+    }
+
+    void CollisionEventDispatcher::internalTickCallback(btDynamicsWorld* dynamicsWorld, btScalar /*timeStep*/) {
+        static_cast<CollisionEventDispatcher*>(dynamicsWorld->getWorldUserInfo())->collectEvents();
+    }
+
+    void CollisionEventDispatcher::collectEvents() {
+        auto dispatcher = dynamicsWorld->getDispatcher();
+        auto numManifolds = dispatcher->getNumManifolds();
+        for (int i = 0; i < numManifolds; i++) {
+            auto manifold = dispatcher->getManifoldByIndexInternal(i);
+            auto numContacts = manifold->getNumContacts();
+            if (numContacts == 0) {
+                continue;
+            }
+
+            auto category0 = getCollisionCategory(*manifold->getBody0());
+            auto category1 = getCollisionCategory(*manifold->getBody1());
+            auto handles0 = static_cast<bool>(handlers[static_cast<size_t>(category0)]);
+            auto handles1 = static_cast<bool>(handlers[static_cast<size_t>(category1)]);
+            if (!handles0 && !handles1) {
+                continue;
+            }
+
+            auto deepest = 0;
+            for (int j = 1; j < numContacts; j++) {
+                if (manifold->getContactPoint(j).getDistance() < manifold->getContactPoint(deepest).getDistance()) {
+                    deepest = j;
+                }
+            }
+
+            // The manifold's normal points from body 1 towards body 0
+            const auto& point = manifold->getContactPoint(deepest);
+            if (handles0) {
+                events.push_back({ category0, manifold->getBody0(), manifold->getBody1(),
+                                   point.getPositionWorldOnA(), point.m_normalWorldOnB });
+            }
+
+            if (handles1) {
+                events.push_back({ category1, manifold->getBody1(), manifold->getBody0(),
+                                   point.getPositionWorldOnB(), -point.m_normalWorldOnB });
+            }
+        }
+    }
+}
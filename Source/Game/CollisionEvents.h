@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include <btBulletDynamicsCommon.h>
+
+namespace tankwars {
+    // What kind of game object a collision object is, stored in its user index
+    enum class CollisionCategory {
+        None,
+        Bullet,
+        Count
+    };
+
+    void setCollisionCategory(btCollisionObject& object, CollisionCategory category);
+    CollisionCategory getCollisionCategory(const btCollisionObject& object);
+
+    struct CollisionEvent {
+        CollisionCategory category;     // The category of object
+        const btCollisionObject* object;
+        const btCollisionObject* other;
+        btVector3 position;             // The deepest contact point on object
+        btVector3 normal;               // Points from other towards object
+    };
+
+    // Finds the contacts of categorized objects by walking the dispatcher's manifolds after every internal
+    // step of the world, instead of a global callback for every contact point. The events are queued and
+    // only handed to the handlers by dispatch(), so they never run inside the simulation.
+    // Uses the world's internal tick callback, so only one dispatcher can be attached to a world.
+    class CollisionEventDispatcher {
+    public:
+        // The queue is reserved for eventCapacity events, more only cost an allocation
+        CollisionEventDispatcher(btDynamicsWorld* dynamicsWorld, size_t eventCapacity);
+        ~CollisionEventDispatcher();
+
+        CollisionEventDispatcher(const CollisionEventDispatcher&) = delete;
+        CollisionEventDispatcher& operator=(const CollisionEventDispatcher&) = delete;
+
+        // Objects of a category without a handler produce no events
+        void setHandler(CollisionCategory category, std::function<void(const CollisionEvent&)> handler);
+
+        // Calls the handlers for the events of all steps since the last call
+        void dispatch();
+
+    private:
+        static void internalTickCallback(btDynamicsWorld* dynamicsWorld, btScalar timeStep);
+        void collectEvents();
+
+        btDynamicsWorld* dynamicsWorld;
+        std::array<std::function<void(const CollisionEvent&)>, static_cast<size_t>(CollisionCategory::Count)> handlers;
+        std::vector<CollisionEvent> events;
+    };
+}
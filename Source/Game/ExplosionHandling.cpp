@@ -9,8 +9,6 @@
 #include "GLTools.h"
 
 namespace tankwars {
-    std::unique_ptr<ExplosionHandler> explosionHandler;
-
 	ExplosionHandler::ExplosionHandler(btDiscreteDynamicsWorld *dynamicsWorld, Renderer& renderer, VoxelTerrain& terrain, Tank* tank1, Tank* tank2, Game* game) 
 			: game(game), 
 			  dnmcWrld(dynamicsWorld), 
@@ -110,6 +108,25 @@ namespace tankwars {
 		explosionPoints.push_back(std::make_pair(explosionAt,owner));
 	}
 
+	void ExplosionHandler::addProjectileImpacts(const std::vector<ProjectileImpact>& impacts) {
+		for (const auto& impact : impacts) {
+			auto bullet = static_cast<Tank::Bullet*>(impact.userPointer);
+			bullet->disableMe = true;
+			addExplosionPoint(btVector3(impact.position.x, impact.position.y, impact.position.z), bullet->owner);
+		}
+	}
+
+	void ExplosionHandler::addBulletHit(const CollisionEvent& event) {
+		// A bullet can touch several things before it is parked
+		auto bullet = static_cast<Tank::Bullet*>(event.object->getUserPointer());
+		if (bullet->disableMe) {
+			return;
+		}
+
+		bullet->disableMe = true;
+		addExplosionPoint(event.position, bullet->owner);
+	}
+
 	void ExplosionHandler::explosion(std::pair<btVector3,int> pair) {
 		smokeParticleSystem.setEmitterPosition(glm::vec3(pair.first.getX(), pair.first.getY(), pair.first.getZ()));
 		starYellowParticleSystem.setEmitterPosition(glm::vec3(pair.first.getX(), pair.first.getY(), pair.first.getZ()));
@@ -120,69 +137,45 @@ namespace tankwars {
 		starYellowParticleSystem.emit(10);
 		
 		starOrangeParticleSystem.emit(5);
-		btVector3 expl(pair.first.getX(), pair.first.getY(), -pair.first.getZ());
-		int xMin = std::max((int)(expl.getX() - explRadius), 1);
-		int yMin = std::max((int)(expl.getY() - explRadius), 1);
-		int zMin = std::max((int)(expl.getZ() - explRadius), 1);
-		int xMax = std::min((int)(expl.getX() + explRadius + 0.5), (int)terrain.getWidth()-3);
-		int yMax = std::min((int)(expl.getY() + explRadius + 0.5), (int)terrain.getHeight()-1);
-		int zMax = std::min((int)(expl.getZ() + explRadius + 0.5), (int)terrain.getDepth()-3);
-		for (int x = xMin; x < xMax; x++) {
-			for (int y = yMin; y < yMax; y++) {
-				for (int z = zMin; z < zMax; z++) {
-					if (pow(x - expl.getX(), 2) + pow(y - expl.getY(), 2) + pow(z - expl.getZ(), 2) < pow(explRadius, 2)) {
-						terrain.setVoxel(x, y, z, tankwars::VoxelType::Empty);
-					}
-				}
-			}
-		}
-		if (pair.second) {
-			glm::vec3 pos = tanks[0]->getPosition();
-			if (pow(pos.x-expl.getX(),2)+ pow(pos.y - expl.getY(), 2)+ pow(pos.z + expl.getZ(), 2)<pow(tankRadius+explRadius,2)) {
-				game->tankGotHit(0);
-			}
-		}
-		else {
-			glm::vec3 pos = tanks[1]->getPosition();
-			if (pow(pos.x - expl.getX(), 2) + pow(pos.y - expl.getY(), 2) + pow(pos.z + expl.getZ(), 2)<pow(tankRadius + explRadius, 2)){
-				game->tankGotHit(1);
-			}
-		}
-        terrain.updateMesh();
+		explosionCenters.push_back(glm::vec3(pair.first.getX(), pair.first.getY(), -pair.first.getZ()));
 	}
 
 	void ExplosionHandler::handleExplosions() {
-		while (explosionPoints.size()) {
-			explosion(explosionPoints.back());
-			explosionPoints.pop_back();
+		numExplosionsLastFrame = explosionPoints.size();
+		if (explosionPoints.empty()) {
+			return;
 		}
-	}
 
-	bool customCallback(btManifoldPoint& cp, const btCollisionObjectWrapper* colObj0Wrap, int partId0, int index0, const btCollisionObjectWrapper* colObj1Wrap, int partId1, int index1) {
-		if (colObj0Wrap->getCollisionObject()->getUserIndex() == 7) {
-			Tank::Bullet* bullet = ((Tank::Bullet*)colObj0Wrap->getCollisionObject()->getUserPointer());
-			bullet->disableMe = true;
-			//std::cout << cp.getPositionWorldOnA().getX() << " " << cp.getPositionWorldOnA().getY() << " " << cp.getPositionWorldOnA().getZ() << "\n";
-			//show aim circle at collision position
-			return false;
-		}
-		if (colObj1Wrap->getCollisionObject()->getUserIndex() == 7) {
-			Tank::Bullet* bullet = ((Tank::Bullet*)colObj1Wrap->getCollisionObject()->getUserPointer());
-			bullet->disableMe = true;
-			//std::cout << cp.getPositionWorldOnB().getX() << " " << cp.getPositionWorldOnB().getY() << " " << cp.getPositionWorldOnB().getZ() << "\n";
-			//show aim circle at collision position
-			return false;
+		explosionCenters.clear();
+		for (const auto& point : explosionPoints) {
+			explosion(point);
 		}
-		if (colObj0Wrap->getCollisionObject()->getUserIndex() == 10) {
-			Tank::Bullet* bullet = ((Tank::Bullet*)colObj0Wrap->getCollisionObject()->getUserPointer());
-			bullet->disableMe = true;
-			explosionHandler->addExplosionPoint(cp.getPositionWorldOnA(), bullet->owner);
+
+		// All craters of a frame are carved at once, so overlapping ones are only written once.
+		// The outer walls of the map and the floor stay intact.
+		VoxelBox bounds(1, 1, 1, terrain.getWidth() - 3, terrain.getHeight() - 1, terrain.getDepth() - 3);
+		terrain.fillSpheres(explosionCenters, explRadius, VoxelType::Empty, bounds);
+
+		// A tank is hit at most once per frame, by any explosion of the other player
+		bool isHit[2] = { false, false };
+		for (const auto& point : explosionPoints) {
+			int target = point.second ? 0 : 1;
+			glm::vec3 pos = tanks[target]->getPosition();
+			if (pow(pos.x - point.first.getX(), 2) + pow(pos.y - point.first.getY(), 2) + pow(pos.z - point.first.getZ(), 2) < pow(tankRadius + explRadius, 2)) {
+				isHit[target] = true;
+			}
 		}
-		if (colObj1Wrap->getCollisionObject()->getUserIndex() == 10) {
-			Tank::Bullet* bullet = ((Tank::Bullet*)colObj1Wrap->getCollisionObject()->getUserPointer());
-			bullet->disableMe = true;
-			explosionHandler->addExplosionPoint(cp.getPositionWorldOnB(), bullet->owner);
+
+		for (int i = 0; i < 2; i++) {
+			if (isHit[i]) {
+				game->tankGotHit(i);
+			}
 		}
-		return false;
+
+		explosionPoints.clear();
+	}
+
+	size_t ExplosionHandler::getNumExplosionsLastFrame() const {
+		return numExplosionsLastFrame;
 	}
 }
\ No newline at end of file
@@ -8,6 +8,8 @@
 #include <btBulletDynamicsCommon.h>
 
 #include "ParticleSystem.h"
+#include "BallisticProjectiles.h"
+#include "CollisionEvents.h"
 
 namespace tankwars {
     class Renderer;
@@ -15,14 +17,17 @@ namespace tankwars {
     class Tank;
     class Game;
 
-	bool customCallback(btManifoldPoint& cp, const btCollisionObjectWrapper* colObj0Wrap, int partId0, int index0, const btCollisionObjectWrapper* colObj1Wrap, int partId1, int index1);
-
 	class ExplosionHandler {
 	public:
 		ExplosionHandler(btDiscreteDynamicsWorld *dynamicsWorld, Renderer& renderer, VoxelTerrain& terrain, Tank* tank1, Tank* tank2, Game* game);
         ~ExplosionHandler();
 		void addExplosionPoint(btVector3 explosionAt, int owner);
+		// Explodes the ballistic bullets that hit something and removes them from their tanks
+		void addProjectileImpacts(const std::vector<ProjectileImpact>& impacts);
+		// Explodes a bullet body at its first contact
+		void addBulletHit(const CollisionEvent& event);
 		void update(btScalar dt);
+		size_t getNumExplosionsLastFrame() const;
 
 	private:
         void handleExplosions();
@@ -39,10 +44,10 @@ namespace tankwars {
 		Tank* tanks[2];
 		btScalar explRadius = 3.5f;
 		std::vector<std::pair<btVector3,int>> explosionPoints;
+		std::vector<glm::vec3> explosionCenters;
+		size_t numExplosionsLastFrame = 0;
 		btDiscreteDynamicsWorld* dnmcWrld;
 		Renderer& renderer;
 		VoxelTerrain& terrain;
 	};
-
-	extern std::unique_ptr<ExplosionHandler> explosionHandler;
 }
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "FixedTimestep.h"
+
+#include <algorithm>
+
+namespace {
+    // Longer frames are stalls like a moved window or a breakpoint, they aren't caught up at all
+    constexpr double MaxFrameTime = 0.25;
+    // Weight of the newest measurement in the average tick cost
+    constexpr double CostSmoothing = 0.1;
+}
+
+namespace tankwars {
+    FixedTimestep::FixedTimestep(double tickTime, size_t maxTicksPerFrame, double budget)
+        : tickTime(tickTime),
+          maxTicksPerFrame(std::max(maxTicksPerFrame, size_t(1))),
+          budget(budget) {
+    }
+
+    size_t FixedTimestep::beginFrame(double frameTime) {
+        droppedTime = 0;
+        if (frameTime > MaxFrameTime) {
+            droppedTime = frameTime - MaxFrameTime;
+            frameTime = MaxFrameTime;
+        }
+
+        accumulator += frameTime;
+        auto wantedTicks = static_cast<size_t>(accumulator / tickTime);
+        numTicks = std::min(wantedTicks, getTickLimit());
+        accumulator -= numTicks * tickTime;
+
+        // Only the fraction of a tick is kept, whole ticks that didn't fit are lost
+        if (numTicks < wantedTicks) {
+            auto skippedTime = (wantedTicks - numTicks) * tickTime;
+            accumulator -= skippedTime;
+            droppedTime += skippedTime;
+        }
+
+        return numTicks;
+    }
+
+    void FixedTimestep::endFrame(double tickMilliseconds) {
+        if (numTicks == 0) {
+            return;
+        }
+
+        auto tickCost = tickMilliseconds / numTicks;
+        if (averageTickCost == 0) {
+            averageTickCost = tickCost;
+        }
+        else {
+            averageTickCost += (tickCost - averageTickCost) * CostSmoothing;
+        }
+    }
+
+    double FixedTimestep::getTickTime() const {
+        return tickTime;
+    }
+
+    float FixedTimestep::getInterpolationFactor() const {
+        return static_cast<float>(std::min(std::max(accumulator / tickTime, 0.0), 1.0));
+    }
+
+    double FixedTimestep::getDroppedTime() const {
+        return droppedTime;
+    }
+
+    size_t FixedTimestep::getTickLimit() const {
+        if (budget <= 0 || averageTickCost <= 0) {
+            return maxTicksPerFrame;
+        }
+
+        // At least one tick, or the game would stop altogether
+        auto ticksInBudget = static_cast<size_t>(budget / averageTickCost);
+        return std::min(std::max(ticksInBudget, size_t(1)), maxTicksPerFrame);
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+
+namespace tankwars {
+    // Splits the time between frames into simulation ticks of a fixed length. How many ticks a frame
+    // may run adapts to what they cost: when they don't fit into the budget, the time they couldn't
+    // catch up on is dropped and the game runs slower instead of every frame taking longer than the last.
+    class FixedTimestep {
+    public:
+        // tickTime in seconds, budget in milliseconds per frame, 0 for no budget besides maxTicksPerFrame
+        FixedTimestep(double tickTime, size_t maxTicksPerFrame, double budget);
+
+        // Adds the time the last frame took and returns how many ticks to run in this one
+        size_t beginFrame(double frameTime);
+
+        // Takes how long the ticks of this frame took in milliseconds, to adapt the tick limit
+        void endFrame(double tickMilliseconds);
+
+        double getTickTime() const;
+
+        // How far the time of this frame is from the last tick towards the next one, from 0 to 1
+        float getInterpolationFactor() const;
+
+        // The time in seconds that was dropped in the last frame because the ticks couldn't keep up
+        double getDroppedTime() const;
+
+        // The number of ticks a frame may run at the moment
+        size_t getTickLimit() const;
+
+    private:
+        double tickTime;
+        size_t maxTicksPerFrame;
+        double budget;
+        double accumulator = 0;
+        double averageTickCost = 0; // In milliseconds, 0 until a tick was measured
+        size_t numTicks = 0;
+        double droppedTime = 0;
+    };
+}
@@ -1,5 +1,6 @@
 #include "Game.h"
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <cstring>
@@ -119,10 +120,14 @@ namespace tankwars {
 		tanks[index]->reset(spawnPos, lookAt);
 	}
 	btScalar Game::getBestHeightFor(btVector3 pos) {
-		int height;
-		for (height = static_cast<int>(terrain->getHeight() - 3); height > 3; height--) {
-			if (!isPlaneClear(pos, height)) {
-				break;
+		// The highest solid voxel under the tank, with one column query per voxel it covers
+		int height = 3;
+		auto endY = terrain->getHeight() - 2;
+		for (int x = static_cast<int>(pos.getX() - tankRadius); x < pos.getX() + tankRadius; x++) {
+			for (int z = static_cast<int>(pos.getZ() - tankRadius); z < pos.getZ() + tankRadius; z++) {
+				if (pow(x - pos.getX(), 2) + pow(z - pos.getZ(), 2) < pow(tankRadius, 2)) {
+					height = std::max(height, static_cast<int>(terrain->getColumnTop(x, z, endY)) - 1);
+				}
 			}
 		}
 		return static_cast<btScalar>(height + 3);
@@ -165,15 +170,15 @@ namespace tankwars {
 	void Game::bindControllerToTank(int controllerID, Tank* tank) {
 		tanks[controllerID] = tank;
 	}
-	void Game::update(float dt) {
-		controller(dt);
+	void Game::update() {
+		controller();
 	}
 
 	void Game::render() {
 
 	}
 
-	void Game::controller(float dt) {
+	void Game::controller() {
 		float movement_alpha = 1;
 		float rotation_alpha = 0.1f;
 
@@ -204,15 +209,15 @@ namespace tankwars {
                 tanks[i]->turnTurretController(value);
             }
 
-            if (buttons[joystickConfigs[i].ToggleShootingMode]) tanks[i]->toggleShootingMode(dt);
-            if (buttons[joystickConfigs[i].Shoot])              tanks[i]->shoot(dt);
+            if (buttons[joystickConfigs[i].ToggleShootingMode]) tanks[i]->toggleShootingMode();
+            if (buttons[joystickConfigs[i].Shoot])              tanks[i]->shoot();
             if (buttons[joystickConfigs[i].Break])              tanks[i]->breakController();
             if (buttons[joystickConfigs[i].DriveBackward])      tanks[i]->driveController(false);
             if (buttons[joystickConfigs[i].DriveForward])       tanks[i]->driveController(true);
-            if (buttons[joystickConfigs[i].DecrPower])          tanks[i]->adjustPower(false, dt);
-            if (buttons[joystickConfigs[i].IncrPower])          tanks[i]->adjustPower(true, dt);
-            if (buttons[joystickConfigs[i].ZoomOut])            tanks[i]->moveCam(false, dt);
-            if (buttons[joystickConfigs[i].ZoomIn])             tanks[i]->moveCam(true, dt);
+            if (buttons[joystickConfigs[i].DecrPower])          tanks[i]->adjustPower(false);
+            if (buttons[joystickConfigs[i].IncrPower])          tanks[i]->adjustPower(true);
+            if (buttons[joystickConfigs[i].ZoomOut])            tanks[i]->moveCam(false);
+            if (buttons[joystickConfigs[i].ZoomIn])             tanks[i]->moveCam(true);
             if (buttons[joystickConfigs[i].Reset]) {
                 glm::vec3 pos = tanks[i]->getPosition();
                 pos.y = getBestHeightFor2(btVector3(pos.x, pos.y, -pos.z));
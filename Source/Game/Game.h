@@ -17,7 +17,8 @@ namespace tankwars {
 
 		int setupControllers(bool disableXboxHack);
 		void addCamera(Camera* camera);
-		void update(float dt);
+		// Runs once per simulation tick, the tanks keep the time of their own cooldowns
+		void update();
 		void render();
 		void bindControllerToTank(int controllerID, Tank* tank);
 		void tankGotHit(int index);
@@ -43,7 +44,7 @@ namespace tankwars {
 		btScalar getBestHeightFor(btVector3 pos);
 		btScalar getBestHeightFor2(btVector3 pos);
 		bool isPlaneClear(btVector3 vec, int height);
-        void controller(float dt);
+        void controller();
 		bool closer(btVector3 vec1, btVector3 vec2, glm::vec3 distanceTo);
 
 		btScalar tankRadius = 1.5f;
@@ -54,8 +55,6 @@ namespace tankwars {
 		VoxelTerrain* terrain;
 		int joystickAvailable[2];
 		float explosion_radius = 3;
-		btScalar lastPositionChange = .0f;
-		btScalar timeBetweenPositionChanges = 3.f;
         
         std::random_device randomDevice;
         std::default_random_engine randomEngine;
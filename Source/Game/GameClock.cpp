@@ -0,0 +1,63 @@
+#include "GameClock.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace tankwars {
+    GameClock::GameClock(double ticksPerSecond)
+        : ticksPerSecond(ticksPerSecond) {
+    }
+
+    void GameClock::advance(Ticks elapsed) {
+        ticks += elapsed;
+    }
+
+    Ticks GameClock::now() const {
+        return ticks;
+    }
+
+    double GameClock::getTickTime() const {
+        return 1.0 / ticksPerSecond;
+    }
+
+    Ticks GameClock::fromSeconds(double seconds) const {
+        if (seconds <= 0) {
+            return 0;
+        }
+
+        return std::max(static_cast<Ticks>(std::llround(seconds * ticksPerSecond)), Ticks(1));
+    }
+
+    double GameClock::toSeconds(Ticks ticks) const {
+        return static_cast<double>(ticks) / ticksPerSecond;
+    }
+
+    Cooldown::Cooldown(Ticks duration)
+        : duration(duration) {
+    }
+
+    void Cooldown::advance(Ticks elapsed) {
+        remaining -= std::min(elapsed, remaining);
+    }
+
+    bool Cooldown::isReady() const {
+        return remaining == 0;
+    }
+
+    bool Cooldown::tryStart() {
+        if (remaining > 0) {
+            return false;
+        }
+
+        remaining = duration;
+        return true;
+    }
+
+    Ticks Cooldown::getDuration() const {
+        return duration;
+    }
+
+    Ticks Cooldown::getRemaining() const {
+        return remaining;
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+
+namespace tankwars {
+    // Game time is counted in whole simulation ticks, which stay exact however long the game runs
+    using Ticks = std::uint64_t;
+
+    // The time of the simulation. It only moves on when a tick is simulated, so the time the
+    // simulation drops when it falls behind doesn't count.
+    class GameClock {
+    public:
+        explicit GameClock(double ticksPerSecond);
+
+        void advance(Ticks elapsed);
+
+        // Ticks simulated since the start
+        Ticks now() const;
+
+        // In seconds
+        double getTickTime() const;
+
+        // Rounded to the closest tick, but at least one for any time above 0
+        Ticks fromSeconds(double seconds) const;
+        double toSeconds(Ticks ticks) const;
+
+    private:
+        double ticksPerSecond;
+        Ticks ticks = 0;
+    };
+
+    // Keeps an action from happening again until a number of ticks passed. The owner hands on the
+    // ticks that elapsed, so it never needs to know the absolute time.
+    class Cooldown {
+    public:
+        // Ready right away
+        explicit Cooldown(Ticks duration = 0);
+
+        void advance(Ticks elapsed);
+        bool isReady() const;
+
+        // Starts over if ready and returns whether it did, the action should happen then
+        bool tryStart();
+
+        Ticks getDuration() const;
+        Ticks getRemaining() const;
+
+    private:
+        Ticks duration;
+        Ticks remaining = 0;
+    };
+}
@@ -1,6 +1,9 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
 #include <cstring>
 #include <cstdlib>
 
@@ -27,6 +30,13 @@
 #include "GLTools.h"
 #include "Hud.h"
 #include "SkyBox.h"
+#include "Benchmark.h"
+#include "BallisticProjectiles.h"
+#include "FixedTimestep.h"
+#include "GameClock.h"
+#include "CollisionEvents.h"
+#include "ParallelCollision.h"
+#include "WorkerPool.h"
 
 constexpr char* WindowTitle = "Tank Wars";
 constexpr int ResolutionX = 1280;
@@ -35,6 +45,21 @@ constexpr bool GoFullscreen = false;
 constexpr bool UseVSync = true;
 constexpr bool UseMsaa = true;
 constexpr double DeltaTime = 1.0 / 60.0;
+constexpr bool UseAsyncRemesh = true;
+constexpr size_t MaxRemeshLatency = 2; // In frames
+constexpr float RemeshBudget = 4.0f; // In milliseconds per frame, 0 for no limit
+constexpr tankwars::VoxelStorageType TerrainStorage = tankwars::VoxelStorageType::Bricked;
+constexpr tankwars::TerrainCollisionType TerrainCollision = tankwars::TerrainCollisionType::LazyChunkMeshes;
+constexpr size_t BulletPoolSize = 20; // Bullets per tank in flight at once
+constexpr bool UseBallisticBullets = false; // Trace the bullets instead of simulating them as rigid bodies
+constexpr double TicksPerSecond = 60.0; // Game logic and physics run in ticks of fixed length
+constexpr size_t MaxTicksPerFrame = 6; // Beyond that, the game slows down instead of catching up
+constexpr double TickBudget = 10.0; // In milliseconds per frame, fewer ticks are run when they take longer
+constexpr float PhysicsTimeStep = 1.0f / 120.0f; // The longest physics step, a tick is split into equal ones
+constexpr size_t PhysicsThreads = 0; // Worker threads of the collision narrowphase, 0 for none
+constexpr float BulletRadius = 0.1f;
+constexpr float TankHitRadius = 1.5f;
+constexpr float GroundHeight = -1.0f; // Of the ground plane around the map
 
 tankwars::Tank *tank;
 
@@ -44,12 +69,25 @@ void errorCallback(int error, const char* description) {
 
 int main(int argc, char* argv[]) {
     // Parse the command line arguments
-    // Example: tankwars -f -m my_level.png -j 1 0
+    // Example: tankwars -f -m my_level.png -j 1 0 -s columns -c voxels
+    //   -s selects how the terrain voxels are stored: byte, bit, bricked, morton or columns
+    //   -c selects the terrain collision: meshes (one per chunk), lazy (chunk meshes only near tanks
+    //      and bullets) or voxels (generated on demand)
+    //   -b selects how bullets fly: bodies (Bullet rigid bodies) or ballistic (traced against the voxels)
+    //   -p sets the number of worker threads the physics narrowphase runs on, 0 for none
+    //   -r sets the simulation ticks per second. The controls are tuned to 60, they act once per tick.
+    //   With --benchmark the performance measurements are printed instead of starting the game
     bool requestFullscreen = false;
     std::string mapName("good_level.png");
     int playerOneController = 0;
     int playerTwoController = 1;
     bool disableXboxHack = false;
+    bool runBenchmark = false;
+    auto terrainStorage = TerrainStorage;
+    auto terrainCollision = TerrainCollision;
+    auto useBallisticBullets = UseBallisticBullets;
+    auto physicsThreads = PhysicsThreads;
+    auto ticksPerSecond = TicksPerSecond;
 
     for (int i = 0; i < argc; i++) {
         if (strcmp(argv[i], "-f") == 0) {
@@ -72,9 +110,95 @@ int main(int argc, char* argv[]) {
             playerOneController = atoi(argv[i + 1]);
             playerTwoController = atoi(argv[i + 2]);
         }
+        else if (strcmp(argv[i], "-s") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "No voxel storage specified!\n";
+                return -1;
+            }
+
+            if (strcmp(argv[i + 1], "byte") == 0) {
+                terrainStorage = tankwars::VoxelStorageType::Byte;
+            }
+            else if (strcmp(argv[i + 1], "bit") == 0) {
+                terrainStorage = tankwars::VoxelStorageType::Bit;
+            }
+            else if (strcmp(argv[i + 1], "bricked") == 0) {
+                terrainStorage = tankwars::VoxelStorageType::Bricked;
+            }
+            else if (strcmp(argv[i + 1], "morton") == 0) {
+                terrainStorage = tankwars::VoxelStorageType::BrickedMorton;
+            }
+            else if (strcmp(argv[i + 1], "columns") == 0) {
+                terrainStorage = tankwars::VoxelStorageType::Columns;
+            }
+            else {
+                std::cerr << "Unknown voxel storage " << argv[i + 1] << "!\n";
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "-c") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "No terrain collision specified!\n";
+                return -1;
+            }
+
+            if (strcmp(argv[i + 1], "meshes") == 0) {
+                terrainCollision = tankwars::TerrainCollisionType::ChunkMeshes;
+            }
+            else if (strcmp(argv[i + 1], "lazy") == 0) {
+                terrainCollision = tankwars::TerrainCollisionType::LazyChunkMeshes;
+            }
+            else if (strcmp(argv[i + 1], "voxels") == 0) {
+                terrainCollision = tankwars::TerrainCollisionType::VoxelShape;
+            }
+            else {
+                std::cerr << "Unknown terrain collision " << argv[i + 1] << "!\n";
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "-b") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "No bullet type specified!\n";
+                return -1;
+            }
+
+            if (strcmp(argv[i + 1], "bodies") == 0) {
+                useBallisticBullets = false;
+            }
+            else if (strcmp(argv[i + 1], "ballistic") == 0) {
+                useBallisticBullets = true;
+            }
+            else {
+                std::cerr << "Unknown bullet type " << argv[i + 1] << "!\n";
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "-p") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "No physics thread count specified!\n";
+                return -1;
+            }
+
+            physicsThreads = static_cast<size_t>(std::max(atoi(argv[i + 1]), 0));
+        }
+        else if (strcmp(argv[i], "-r") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "No tick rate specified!\n";
+                return -1;
+            }
+
+            ticksPerSecond = atof(argv[i + 1]);
+            if (ticksPerSecond <= 0) {
+                std::cerr << "Invalid tick rate " << argv[i + 1] << "!\n";
+                return -1;
+            }
+        }
         else if (strcmp(argv[i], "--noxbox") == 0) {
             disableXboxHack = true;
         }
+        else if (strcmp(argv[i], "--benchmark") == 0) {
+            runBenchmark = true;
+        }
     }
 
     // Init glfw
@@ -129,14 +253,24 @@ int main(int argc, char* argv[]) {
         return -1;
     }
 
-    // Init bullet physics
+    // Init bullet physics, the narrowphase runs on the physics threads
+    tankwars::WorkerPool physicsWorkerPool(physicsThreads);
     std::unique_ptr<btBroadphaseInterface> broadphase(new btDbvtBroadphase);
-    std::unique_ptr<btDefaultCollisionConfiguration> collisionConfiguration(new btDefaultCollisionConfiguration);
-    std::unique_ptr<btCollisionDispatcher> dispatcher(new btCollisionDispatcher(collisionConfiguration.get()));
+    std::unique_ptr<tankwars::ParallelCollisionConfiguration> collisionConfiguration(
+        new tankwars::ParallelCollisionConfiguration);
+    std::unique_ptr<btCollisionDispatcher> dispatcher(new tankwars::ParallelCollisionDispatcher(
+        collisionConfiguration.get(), physicsWorkerPool));
     std::unique_ptr<btSequentialImpulseConstraintSolver> solver(new btSequentialImpulseConstraintSolver);
     std::unique_ptr<btDiscreteDynamicsWorld> dynamicsWorld(new btDiscreteDynamicsWorld(
         dispatcher.get(), broadphase.get(), solver.get(), collisionConfiguration.get()));
 
+    if (runBenchmark) {
+        tankwars::runBenchmarks("Content/Maps/" + mapName, dynamicsWorld.get());
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return 0;
+    }
+
     // Init input systems
     tankwars::Keyboard::init();
     glfwSetKeyCallback(window, &tankwars::Keyboard::keyCallback);
@@ -145,7 +279,10 @@ int main(int argc, char* argv[]) {
     // Setup game stuff
     tankwars::Renderer renderer;
     tankwars::VoxelTerrain terrain2 = tankwars::VoxelTerrain::fromHeightMap(
-        "Content/Maps/" + mapName, dynamicsWorld.get(), 16, 8, 16, 8);
+        "Content/Maps/" + mapName, dynamicsWorld.get(), 16, 8, 16, 8, terrainStorage, terrainCollision);
+    terrain2.setAsyncRemeshEnabled(UseAsyncRemesh);
+    terrain2.setMaxRemeshLatency(MaxRemeshLatency);
+    terrain2.setRemeshBudget(RemeshBudget);
     renderer.setTerrain(&terrain2);
 
     tankwars::SkyBox skyBox(
@@ -157,9 +294,22 @@ int main(int argc, char* argv[]) {
         "Content/Skybox/Floor.png");
     renderer.setSkyBox(&skyBox);
 	
-    tankwars::Tank tank1(dynamicsWorld.get(),renderer, btVector3(30, 25, -30),0);
-	tankwars::Tank tank2(dynamicsWorld.get(), renderer, btVector3(40, 25, -40), 1);
-	gContactAddedCallback = tankwars::customCallback;
+    // Ballistic bullets of both tanks fly in one shared set of projectiles
+    std::unique_ptr<tankwars::BallisticProjectiles> ballisticProjectiles;
+    std::vector<tankwars::ProjectileTarget> projectileTargets(2);
+    std::vector<tankwars::ProjectileImpact> projectileImpacts;
+    if (useBallisticBullets) {
+        auto gravity = dynamicsWorld->getGravity();
+        ballisticProjectiles.reset(new tankwars::BallisticProjectiles(terrain2, 2 * BulletPoolSize, BulletRadius,
+            glm::vec3(gravity.x(), gravity.y(), gravity.z()), GroundHeight));
+    }
+
+    // Counts the simulation ticks, everything that happens after a while waits for a number of them
+    tankwars::GameClock clock(ticksPerSecond);
+    tankwars::Tank tank1(dynamicsWorld.get(), renderer, terrain2, clock, btVector3(30, 25, -30), 0, BulletPoolSize,
+        ballisticProjectiles.get());
+	tankwars::Tank tank2(dynamicsWorld.get(), renderer, terrain2, clock, btVector3(40, 25, -40), 1, BulletPoolSize,
+        ballisticProjectiles.get());
     
     float roll = 0.0f;
     float yaw = 0.0f;
@@ -169,14 +319,22 @@ int main(int argc, char* argv[]) {
     freeCam.aspectRatio = 16 / 4.5f;
     freeCam.position = { 10, 40, 10 };
     renderer.attachCamera(tankwars::Renderer::ViewportTop, freeCam);
+    terrain2.attachCamera(freeCam);
 	tankwars::Game game(&freeCam, &terrain2);
-	tankwars::explosionHandler.reset(new tankwars::ExplosionHandler(
+	std::unique_ptr<tankwars::ExplosionHandler> explosionHandler(new tankwars::ExplosionHandler(
         dynamicsWorld.get(), renderer, terrain2, &tank1, &tank2, &game));
+
+    // Bullet bodies explode at their first contact, found after the physics steps
+    tankwars::CollisionEventDispatcher collisionEvents(dynamicsWorld.get(), 2 * BulletPoolSize);
+    collisionEvents.setHandler(tankwars::CollisionCategory::Bullet, [&](const tankwars::CollisionEvent& event) {
+        explosionHandler->addBulletHit(event);
+    });
     
     tankwars::Camera freeCam2;
     freeCam2.position = { 15, 40, 10 };
     freeCam2.aspectRatio = 16 / 4.5f;
     renderer.attachCamera(tankwars::Renderer::ViewportBottom, freeCam2);
+    terrain2.attachCamera(freeCam2);
     renderer.setSplitScreenEnabled(true);
 
 	game.setupControllers(disableXboxHack);
@@ -336,29 +494,71 @@ int main(int argc, char* argv[]) {
     // The game loop
     auto lastTime = glfwGetTime();
 	int i = 0;
+    // F3 toggles printing how many chunks were remeshed, are still waiting and have collision
+    // in frames that remeshed any
+    bool reportRemeshCounts = false;
+    // F4 toggles printing the frames in which the simulation fell behind and time was dropped
+    bool reportDroppedTime = false;
+
+    // The physics steps split every tick evenly, so they stay in lockstep with the game logic
+    tankwars::FixedTimestep timestep(clock.getTickTime(), MaxTicksPerFrame, TickBudget);
+    auto tickTime = static_cast<float>(timestep.getTickTime());
+    auto physicsSteps = std::max(static_cast<int>(std::ceil(tickTime / PhysicsTimeStep - 0.001f)), 1);
+    auto physicsStepTime = tickTime / physicsSteps;
+
     while (!glfwWindowShouldClose(window)) {
         auto currentTime = glfwGetTime();
         auto frameTime = static_cast<float>(currentTime - lastTime);
         lastTime = currentTime;
 
         // Update simulation
-        dynamicsWorld->stepSimulation(frameTime, 15, 1.0f / 120.0f);
+        auto numTicks = timestep.beginFrame(frameTime);
+        for (size_t tick = 0; tick < numTicks; tick++) {
+            clock.advance(1);
 
-        // Update game here
-		game.update((float)currentTime);
+            // A variable step of Bullet is a single step without its own interpolation
+            for (int step = 0; step < physicsSteps; step++) {
+                dynamicsWorld->stepSimulation(physicsStepTime, 0);
+            }
+
+            collisionEvents.dispatch();
+            if (ballisticProjectiles) {
+                projectileTargets[0] = { tank1.getPosition(), TankHitRadius };
+                projectileTargets[1] = { tank2.getPosition(), TankHitRadius };
+                projectileImpacts.clear();
+                ballisticProjectiles->update(tickTime, PhysicsTimeStep, projectileTargets, projectileImpacts);
+                explosionHandler->addProjectileImpacts(projectileImpacts);
+            }
+
+            // Update game here
+            game.update();
+            if (tankwars::Keyboard::isKeyDown(GLFW_KEY_I))tank1.drive(true);
+            if (tankwars::Keyboard::isKeyDown(GLFW_KEY_K)) { tank1.drive(false); tank1.driveBack(false); }
+            if (tankwars::Keyboard::isKeyDown(GLFW_KEY_O)) tank1.driveBack(true);
+            if (tankwars::Keyboard::isKeyDown(GLFW_KEY_J))tank1.turn(true);
+            if (tankwars::Keyboard::isKeyDown(GLFW_KEY_L))tank1.turn(false);
+
+            tank1.update(1);
+            tank2.update(1);
+        }
+
+        timestep.endFrame((glfwGetTime() - currentTime) * 1000.0);
+        if (reportDroppedTime && timestep.getDroppedTime() > 0) {
+            std::cout << "Tick " << clock.now() << ": simulation fell behind by " << timestep.getDroppedTime() * 1000.0 << " ms, "
+                      << numTicks << " ticks this frame, limit " << timestep.getTickLimit() << "\n";
+        }
 
-		
 		hudSprite4.texSize[1] = 0.2923f + tank1.getShootingPowerInSteps()*0.002226f;
 		hudSprite4.size[1] = 0.5261f + tank1.getShootingPowerInSteps()*0.0040095f;
 
 		hudSprite42.texSize[1] = 0.2923f + tank2.getShootingPowerInSteps()*0.002226f;
 		hudSprite42.size[1] = 0.5261f + tank2.getShootingPowerInSteps()*0.0040095f;
 
-		hudSprite3.texSize[1] = 0.34f + tank1.getShootingTimerRestInSteps((float)currentTime)*0.0024f;
-		hudSprite3.size[1] = 0.612f + tank1.getShootingTimerRestInSteps((float)currentTime)*0.00432f;
+		hudSprite3.texSize[1] = 0.34f + tank1.getShootingTimerRestInSteps()*0.0024f;
+		hudSprite3.size[1] = 0.612f + tank1.getShootingTimerRestInSteps()*0.00432f;
 
-		hudSprite32.texSize[1] = 0.34f + tank2.getShootingTimerRestInSteps((float)currentTime)*0.0024f;
-		hudSprite32.size[1] = 0.612f + tank2.getShootingTimerRestInSteps((float)currentTime)*0.00432f;
+		hudSprite32.texSize[1] = 0.34f + tank2.getShootingTimerRestInSteps()*0.0024f;
+		hudSprite32.size[1] = 0.612f + tank2.getShootingTimerRestInSteps()*0.00432f;
 		
 		number1.texture = numbers[tank1.getPoints() % 10];
 		number2.texture = numbers[((int)(tank1.getPoints() / 10)) % 10];
@@ -394,18 +594,12 @@ int main(int argc, char* argv[]) {
         if (tankwars::Keyboard::isKeyDown(GLFW_KEY_DOWN)) roll -= glm::quarter_pi<float>() *  static_cast<float>(frameTime);
         if (tankwars::Keyboard::isKeyDown(GLFW_KEY_LEFT)) yaw += glm::quarter_pi<float>() *  static_cast<float>(frameTime);
         if (tankwars::Keyboard::isKeyDown(GLFW_KEY_RIGHT)) yaw -= glm::quarter_pi<float>() *  static_cast<float>(frameTime);
-		if (tankwars::Keyboard::isKeyDown(GLFW_KEY_I))tank1.drive(true);
-		if (tankwars::Keyboard::isKeyDown(GLFW_KEY_K)) { tank1.drive(false); tank1.driveBack(false); }
-	    if (tankwars::Keyboard::isKeyDown(GLFW_KEY_O)) tank1.driveBack(true);
-		if (tankwars::Keyboard::isKeyDown(GLFW_KEY_J))tank1.turn(true);
-        if (tankwars::Keyboard::isKeyDown(GLFW_KEY_L))tank1.turn(false);
         if (tankwars::Keyboard::isKeyDown(GLFW_KEY_SPACE)) {
             for (size_t z = 1; z < terrain2.getDepth()-1; z++)
             for (size_t y = 1; y < terrain2.getHeight()-1; y++)
             for (size_t x = 1; x < terrain2.getWidth()-1; x++) {
                 terrain2.setVoxel(x, y, z, tankwars::VoxelType::Empty);
             }
-            terrain2.updateMesh();
         }
         if (tankwars::Keyboard::isKeyDown(GLFW_KEY_V)) {
             for (size_t z = 0; z < terrain2.getDepth(); z++)
@@ -413,7 +607,6 @@ int main(int argc, char* argv[]) {
             for (size_t x = 0; x < terrain2.getWidth(); x++) {
                 terrain2.setVoxel(x, y, z, tankwars::VoxelType::Solid);
             }
-            terrain2.updateMesh();
         }
         if (tankwars::Keyboard::isKeyPressed(GLFW_KEY_F1)) {
             renderer.setSplitScreenEnabled(false);
@@ -423,20 +616,39 @@ int main(int argc, char* argv[]) {
             renderer.setSplitScreenEnabled(true);
             freeCam.aspectRatio = 16.0f / 4.5f;
         }
+        if (tankwars::Keyboard::isKeyPressed(GLFW_KEY_F3)) {
+            reportRemeshCounts = !reportRemeshCounts;
+        }
+        if (tankwars::Keyboard::isKeyPressed(GLFW_KEY_F4)) {
+            reportDroppedTime = !reportDroppedTime;
+        }
 		
-		freeCam2.position = (tank2.getPosition() + glm::normalize(-tank2.getDirectionVector())*tank2.getCameraOffsetDistance() + glm::vec3(0, tank2.getCameraOffsetHeight(), 0));
-        freeCam2.lookAt(tank2.getPosition() + glm::vec3(0,3,0), { 0,1,0 });
+		explosionHandler->update(frameTime);
+
+        // Draw the tanks between the last two ticks, after the explosions may have moved them
+        auto alpha = timestep.getInterpolationFactor();
+        tank1.interpolate(alpha);
+        tank2.interpolate(alpha);
+
+		freeCam2.position = (tank2.getRenderPosition() + glm::normalize(-tank2.getRenderDirectionVector())*tank2.getCameraOffsetDistance() + glm::vec3(0, tank2.getCameraOffsetHeight(), 0));
+        freeCam2.lookAt(tank2.getRenderPosition() + glm::vec3(0,3,0), { 0,1,0 });
 
         freeCam2.update();
 
-		freeCam.position = (tank1.getPosition() + glm::normalize(-tank1.getDirectionVector())*tank1.getCameraOffsetDistance() + glm::vec3(0, tank1.getCameraOffsetHeight(), 0));
-		freeCam.lookAt(tank1.getPosition() + glm::vec3(0, 3, 0), { 0,1,0 });
+		freeCam.position = (tank1.getRenderPosition() + glm::normalize(-tank1.getRenderDirectionVector())*tank1.getCameraOffsetDistance() + glm::vec3(0, tank1.getCameraOffsetHeight(), 0));
+		freeCam.lookAt(tank1.getRenderPosition() + glm::vec3(0, 3, 0), { 0,1,0 });
 		//freeCam.setAxes(glm::quat({ roll, yaw, 0 }));
         freeCam.update();
-		
-		tank1.update((float)currentTime);
-		tank2.update((float)currentTime);
-		tankwars::explosionHandler->update(frameTime);
+        terrain2.updateMesh();
+
+        if (reportRemeshCounts && terrain2.getNumChunksRemeshed() > 0) {
+            std::cout << "Explosions: " << explosionHandler->getNumExplosionsLastFrame()
+                      << ", chunks remeshed: " << terrain2.getNumChunksRemeshed()
+                      << ", backlog: " << terrain2.getRemeshBacklogSize()
+                      << " chunks, oldest " << terrain2.getRemeshBacklogAge() << " frames, collision: "
+                      << terrain2.getNumCollisionChunks() << " chunks, "
+                      << terrain2.getNumHeightfieldColumns() << " heightfields\n";
+        }
 
         // Render
         int backBufferWidth, backBufferHeight;
@@ -2,6 +2,17 @@
 
 #include <cmath>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MARCHING_CUBES_USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define MARCHING_CUBES_USE_SSE2 0
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace {
     const uint32_t edgeTable[256]= {
         0x0  , 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c,
@@ -302,17 +313,56 @@ namespace {
         {4, 5}, {5, 6}, {6, 7}, {7, 4},
         {0, 4}, {1, 5}, {2, 6}, {3, 7}
     };
-}
 
-namespace tankwars {
-    void polygonize(const GridCell& gridCell,
-                    std::vector<glm::vec3>& outPositions,
-                    std::vector<uint32_t>& outIndices) {
+    // For every edge of a cell: the offset of its lower voxel from the cell's origin and its axis
+    const uint32_t edgeVoxels[12][4] = {
+        {0, 0, 1, 0}, {1, 0, 0, 2}, {0, 0, 0, 0}, {0, 0, 0, 2},
+        {0, 1, 1, 0}, {1, 1, 0, 2}, {0, 1, 0, 0}, {0, 1, 0, 2},
+        {0, 0, 1, 1}, {1, 0, 1, 1}, {1, 0, 0, 1}, {0, 0, 0, 1}
+    };
+
+    glm::vec3 interpolateEdge(const tankwars::GridCell& gridCell, int edgeIndex) {
+        const auto edge = edgeIndices[edgeIndex];
+        auto p1 = gridCell.positions[edge[0]];
+        auto p2 = gridCell.positions[edge[1]];
+        float a = gridCell.values[edge[0]];
+        float b = gridCell.values[edge[1]];
+        float d = a - b;
+        float t = 0.0f;
+
+        if (abs(d) > 1e-6f) {
+            t = a / d;
+        }
+
+        glm::vec3 vertex;
+        vertex.x = p1.x + t * (p2.x - p1.x);
+        vertex.y = p1.y + t * (p2.y - p1.y);
+        vertex.z = -(p1.z + t * (p2.z - p1.z));
+        return vertex;
+    }
+
+    uint32_t computeCubeIndex(const tankwars::GridCell& gridCell) {
         uint32_t cubeIndex = 0;
         for (int i = 0; i < 8; i++) {
             cubeIndex |= (gridCell.values[i] > 0) ? (1 << i) : 0;
         }
 
+        return cubeIndex;
+    }
+
+    void emitTriangles(uint32_t cubeIndex, const uint32_t* edges, std::vector<uint32_t>& outIndices) {
+        auto faces = triTable[cubeIndex];
+        for (size_t i = 0; faces[i] != -1; i += 3) {
+            outIndices.push_back(edges[faces[i]]);
+            outIndices.push_back(edges[faces[i + 1]]);
+            outIndices.push_back(edges[faces[i + 2]]);
+        }
+    }
+
+    void polygonizeCell(uint32_t cubeIndex, const tankwars::GridCell& gridCell,
+                        tankwars::EdgeCache& edgeCache,
+                        std::vector<glm::vec3>& outPositions,
+                        std::vector<uint32_t>& outIndices) {
         auto edgeMask = edgeTable[cubeIndex];
         if (edgeMask == 0) {
             return;
@@ -324,31 +374,190 @@ namespace tankwars {
                 continue;
             }
 
-            edges[i] = static_cast<uint32_t>(outPositions.size());
-            const auto edge = edgeIndices[i];
-            auto p1 = gridCell.positions[edge[0]];
-            auto p2 = gridCell.positions[edge[1]];
-            float a = gridCell.values[edge[0]];
-            float b = gridCell.values[edge[1]];
-            float d = a - b;
-            float t = 0.0f;
-
-            if (abs(d) > 1e-6f) {
-                t = a / d;
+            auto& vertexIndex = edgeCache.getVertexIndex(i);
+            if (vertexIndex == tankwars::EdgeCache::InvalidIndex) {
+                vertexIndex = static_cast<uint32_t>(outPositions.size());
+                outPositions.push_back(interpolateEdge(gridCell, i));
             }
 
-            glm::vec3 vertex;
-            vertex.x = p1.x + t * (p2.x - p1.x);
-            vertex.y = p1.y + t * (p2.y - p1.y);
-            vertex.z = -(p1.z + t * (p2.z - p1.z));
-            outPositions.push_back(vertex);
+            edges[i] = vertexIndex;
         }
 
-        auto faces = triTable[cubeIndex];
-        for (size_t i = 0; faces[i] != -1; i += 3) {
-            outIndices.push_back(edges[faces[i]]);
-            outIndices.push_back(edges[faces[i + 1]]);
-            outIndices.push_back(edges[faces[i + 2]]);
+        emitTriangles(cubeIndex, edges, outIndices);
+    }
+
+    // The four voxels of a column at (x, y..y+1, z..z+1) are packed into 4 bits:
+    // (x, y, z + 1), (x, y, z), (x, y + 1, z + 1), (x, y + 1, z).
+    // These tables map them to the cube index bits of the cell left and right of the column.
+    const uint8_t columnToLeftCorners[16] = {
+        0, 1, 8, 9, 16, 17, 24, 25, 128, 129, 136, 137, 144, 145, 152, 153
+    };
+
+    const uint8_t columnToRightCorners[16] = {
+        0, 2, 4, 6, 32, 34, 36, 38, 64, 66, 68, 70, 96, 98, 100, 102
+    };
+
+#if MARCHING_CUBES_USE_SSE2
+    // Sets the corner bit in the cube indices of the cells whose voxel isn't empty
+    inline __m128i addCorner(__m128i cubeIndices, const uint8_t* voxels, int corner) {
+        auto values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(voxels));
+        auto isEmpty = _mm_cmpeq_epi8(values, _mm_setzero_si128());
+        auto bit = _mm_andnot_si128(isEmpty, _mm_set1_epi8(static_cast<char>(1 << corner)));
+        return _mm_or_si128(cubeIndices, bit);
+    }
+
+    // Computes the cube indices of 16 cells in a row. Returns a bit mask of the cells that
+    // are neither completely empty nor completely solid, which are the only ones with triangles.
+    inline uint32_t classifyCells(const uint8_t* row00, const uint8_t* row01,
+                                  const uint8_t* row10, const uint8_t* row11,
+                                  uint8_t* outCubeIndices) {
+        auto cubeIndices = _mm_setzero_si128();
+        cubeIndices = addCorner(cubeIndices, row10,     0);
+        cubeIndices = addCorner(cubeIndices, row10 + 1, 1);
+        cubeIndices = addCorner(cubeIndices, row00 + 1, 2);
+        cubeIndices = addCorner(cubeIndices, row00,     3);
+        cubeIndices = addCorner(cubeIndices, row11,     4);
+        cubeIndices = addCorner(cubeIndices, row11 + 1, 5);
+        cubeIndices = addCorner(cubeIndices, row01 + 1, 6);
+        cubeIndices = addCorner(cubeIndices, row01,     7);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(outCubeIndices), cubeIndices);
+
+        auto isEmpty = _mm_cmpeq_epi8(cubeIndices, _mm_setzero_si128());
+        auto isSolid = _mm_cmpeq_epi8(cubeIndices, _mm_set1_epi8(static_cast<char>(0xff)));
+        return static_cast<uint32_t>(~_mm_movemask_epi8(_mm_or_si128(isEmpty, isSolid))) & 0xffff;
+    }
+
+    inline uint32_t countTrailingZeros(uint32_t value) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, value);
+        return static_cast<uint32_t>(index);
+#else
+        return static_cast<uint32_t>(__builtin_ctz(value));
+#endif
+    }
+#endif
+}
+
+namespace tankwars {
+    constexpr uint32_t EdgeCache::InvalidIndex;
+
+    void EdgeCache::reset(size_t numCellsX, size_t numCellsY, size_t numCellsZ) {
+        strideY = numCellsX + 1;
+        strideZ = strideY * (numCellsY + 1);
+        cellBase = 0;
+
+        for (int i = 0; i < 12; i++) {
+            const auto voxel = edgeVoxels[i];
+            edgeOffsets[i] = (voxel[0] + voxel[1] * strideY + voxel[2] * strideZ) * 3 + voxel[3];
+        }
+
+        vertexIndices.assign(strideZ * (numCellsZ + 1) * 3, InvalidIndex);
+    }
+
+    void polygonize(const GridCell& gridCell,
+                    std::vector<glm::vec3>& outPositions,
+                    std::vector<uint32_t>& outIndices) {
+        auto cubeIndex = computeCubeIndex(gridCell);
+        auto edgeMask = edgeTable[cubeIndex];
+        if (edgeMask == 0) {
+            return;
+        }
+
+        uint32_t edges[12];
+        for (int i = 0; i < 12; i++) {
+            if ((edgeMask & (1 << i)) == 0) {
+                continue;
+            }
+
+            edges[i] = static_cast<uint32_t>(outPositions.size());
+            outPositions.push_back(interpolateEdge(gridCell, i));
+        }
+
+        emitTriangles(cubeIndex, edges, outIndices);
+    }
+
+    void polygonize(const GridCell& gridCell,
+                    EdgeCache& edgeCache,
+                    std::vector<glm::vec3>& outPositions,
+                    std::vector<uint32_t>& outIndices) {
+        polygonizeCell(computeCubeIndex(gridCell), gridCell, edgeCache, outPositions, outIndices);
+    }
+
+    void polygonizeBlock(const uint8_t* voxels,
+                         size_t numCellsX, size_t numCellsY, size_t numCellsZ,
+                         const glm::vec3& origin,
+                         EdgeCache& edgeCache,
+                         std::vector<glm::vec3>& outPositions,
+                         std::vector<uint32_t>& outIndices) {
+        auto strideY = numCellsX + 1;
+        auto strideZ = strideY * (numCellsY + 1);
+        edgeCache.reset(numCellsX, numCellsY, numCellsZ);
+
+        GridCell gridCell;
+        auto polygonizeSurfaceCell = [&](size_t x, size_t y, size_t z, uint32_t cubeIndex) {
+            glm::vec3 position = origin + glm::vec3(x, y, z);
+            gridCell.positions[0] = position + glm::vec3(0, 0, 1);
+            gridCell.positions[1] = position + glm::vec3(1, 0, 1);
+            gridCell.positions[2] = position + glm::vec3(1, 0, 0);
+            gridCell.positions[3] = position;
+            gridCell.positions[4] = position + glm::vec3(0, 1, 1);
+            gridCell.positions[5] = position + glm::vec3(1, 1, 1);
+            gridCell.positions[6] = position + glm::vec3(1, 1, 0);
+            gridCell.positions[7] = position + glm::vec3(0, 1, 0);
+
+            for (int i = 0; i < 8; i++) {
+                gridCell.values[i] = (cubeIndex >> i) & 1;
+            }
+
+            edgeCache.moveTo(x, y, z);
+            polygonizeCell(cubeIndex, gridCell, edgeCache, outPositions, outIndices);
+        };
+
+        for (size_t z = 0; z < numCellsZ; z++) {
+            // The two slabs of voxels on both sides of the cell layer
+            const auto slab0 = voxels + z * strideZ;
+            const auto slab1 = slab0 + strideZ;
+
+            for (size_t y = 0; y < numCellsY; y++) {
+                const auto row00 = slab0 + y * strideY;
+                const auto row01 = row00 + strideY;
+                const auto row10 = slab1 + y * strideY;
+                const auto row11 = row10 + strideY;
+                size_t x = 0;
+
+#if MARCHING_CUBES_USE_SSE2
+                // Classify 16 cells at once and only hand the surface cells on
+                for (; x + 16 <= numCellsX; x += 16) {
+                    uint8_t cubeIndices[16];
+                    auto surfaceCells = classifyCells(row00 + x, row01 + x, row10 + x, row11 + x, cubeIndices);
+                    while (surfaceCells != 0) {
+                        auto i = countTrailingZeros(surfaceCells);
+                        surfaceCells &= surfaceCells - 1;
+                        polygonizeSurfaceCell(x + i, y, z, cubeIndices[i]);
+                    }
+                }
+#endif
+
+                // Scalar path for the rest of the row
+                if (x == numCellsX) {
+                    continue;
+                }
+
+                auto column = (row10[x] != 0) | (row00[x] != 0) << 1 | (row11[x] != 0) << 2 | (row01[x] != 0) << 3;
+                for (; x < numCellsX; x++) {
+                    // The right column of this cell is the left column of the next one
+                    auto nextColumn = (row10[x + 1] != 0) | (row00[x + 1] != 0) << 1 |
+                                      (row11[x + 1] != 0) << 2 | (row01[x + 1] != 0) << 3;
+                    uint32_t cubeIndex = columnToLeftCorners[column] | columnToRightCorners[nextColumn];
+                    column = nextColumn;
+
+                    // Grid cells are only needed where the surface is
+                    if (cubeIndex != 0 && cubeIndex != 255) {
+                        polygonizeSurfaceCell(x, y, z, cubeIndex);
+                    }
+                }
+            }
         }
     }
 }
\ No newline at end of file
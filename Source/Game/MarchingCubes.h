@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -11,7 +12,48 @@ namespace tankwars {
         uint8_t values[8];
     };
 
+    // Remembers the vertex created on every voxel edge of a block of cells,
+    // so that neighbouring cells share their vertices instead of duplicating them
+    class EdgeCache {
+    public:
+        static constexpr uint32_t InvalidIndex = 0xffffffff;
+
+        void reset(size_t numCellsX, size_t numCellsY, size_t numCellsZ);
+
+        // Selects the cell whose edges are returned by getVertexIndex()
+        void moveTo(size_t x, size_t y, size_t z) {
+            cellBase = (x + y * strideY + z * strideZ) * 3;
+        }
+
+        uint32_t& getVertexIndex(int edge) {
+            return vertexIndices[cellBase + edgeOffsets[edge]];
+        }
+
+    private:
+        size_t strideY = 0;
+        size_t strideZ = 0;
+        size_t cellBase = 0;
+        size_t edgeOffsets[12];
+        std::vector<uint32_t> vertexIndices;
+    };
+
     void polygonize(const GridCell& gridCell,
                     std::vector<glm::vec3>& outPositions,
                     std::vector<uint32_t>& outIndices);
+
+    // Same as above, but reuses the vertices of neighbouring cells through the cache
+    void polygonize(const GridCell& gridCell,
+                    EdgeCache& edgeCache,
+                    std::vector<glm::vec3>& outPositions,
+                    std::vector<uint32_t>& outIndices);
+
+    // Runs marching cubes on a block of voxels stored as x + y * (numCellsX + 1) + z * (numCellsX + 1) * (numCellsY + 1).
+    // Walks two z-slabs at a time and derives each cube index from the one of the previous cell in the row,
+    // so a voxel is read once per row of cells instead of once per cell that touches it.
+    void polygonizeBlock(const uint8_t* voxels,
+                         size_t numCellsX, size_t numCellsY, size_t numCellsZ,
+                         const glm::vec3& origin,
+                         EdgeCache& edgeCache,
+                         std::vector<glm::vec3>& outPositions,
+                         std::vector<uint32_t>& outIndices);
 }
\ No newline at end of file
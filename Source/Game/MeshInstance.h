@@ -13,5 +13,8 @@ namespace tankwars {
         const Mesh* mesh = nullptr;
         Material* material = nullptr;
         glm::mat4 modelMatrix{ 1.0f };
+
+        // Hidden instances stay in the renderer's scene but aren't drawn
+        bool visible = true;
     };
 }
\ No newline at end of file
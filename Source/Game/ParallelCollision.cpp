@@ -0,0 +1,124 @@
+#include "ParallelCollision.h"
+
+#include <algorithm>
+#include <new>
+
+#include <BulletCollision/CollisionDispatch/btConvexConvexAlgorithm.h>
+#include <LinearMath/btPoolAllocator.h>
+
+#include "WorkerPool.h"
+
+namespace {
+    // Pairs differ a lot in cost, so they are handed out in small batches
+    constexpr int PairsPerTask = 16;
+
+    class ConvexConvexAlgorithm : public btConvexConvexAlgorithm {
+    public:
+        // The base only stores the pointer to the simplex solver, which is constructed right after it
+        ConvexConvexAlgorithm(btPersistentManifold* manifold, const btCollisionAlgorithmConstructionInfo& ci,
+                              const btCollisionObjectWrapper* body0Wrap, const btCollisionObjectWrapper* body1Wrap,
+                              btConvexPenetrationDepthSolver* pdSolver, int numPerturbationIterations,
+                              int minimumPointsPerturbationThreshold)
+            : btConvexConvexAlgorithm(manifold, ci, body0Wrap, body1Wrap, &simplexSolver, pdSolver,
+                                      numPerturbationIterations, minimumPointsPerturbationThreshold) {
+        }
+
+        // Derived from Bullet's, so setConvexConvexMultipointIterations still works
+        struct CreateFunc : public btConvexConvexAlgorithm::CreateFunc {
+            explicit CreateFunc(btConvexPenetrationDepthSolver* pdSolver)
+                : btConvexConvexAlgorithm::CreateFunc(nullptr, pdSolver) {
+            }
+
+            btCollisionAlgorithm* CreateCollisionAlgorithm(btCollisionAlgorithmConstructionInfo& ci,
+                                                           const btCollisionObjectWrapper* body0Wrap,
+                                                           const btCollisionObjectWrapper* body1Wrap) override {
+                auto mem = ci.m_dispatcher1->allocateCollisionAlgorithm(sizeof(ConvexConvexAlgorithm));
+                return new(mem) ConvexConvexAlgorithm(ci.m_manifold, ci, body0Wrap, body1Wrap, m_pdSolver,
+                                                      m_numPerturbationIterations,
+                                                      m_minimumPointsPerturbationThreshold);
+            }
+        };
+
+    private:
+        btVoronoiSimplexSolver simplexSolver;
+    };
+
+    btDefaultCollisionConstructionInfo getConstructionInfo() {
+        btDefaultCollisionConstructionInfo constructionInfo;
+        constructionInfo.m_customCollisionAlgorithmMaxElementSize = sizeof(ConvexConvexAlgorithm);
+        return constructionInfo;
+    }
+}
+
+namespace tankwars {
+    ParallelCollisionConfiguration::ParallelCollisionConfiguration()
+        : btDefaultCollisionConfiguration(getConstructionInfo()) {
+        // Freed by the base class like the create function it replaces
+        m_convexConvexCreateFunc->~btCollisionAlgorithmCreateFunc();
+        btAlignedFree(m_convexConvexCreateFunc);
+        auto mem = btAlignedAlloc(sizeof(ConvexConvexAlgorithm::CreateFunc), 16);
+        m_convexConvexCreateFunc = new(mem) ConvexConvexAlgorithm::CreateFunc(m_pdSolver);
+    }
+
+    ParallelCollisionDispatcher::ParallelCollisionDispatcher(ParallelCollisionConfiguration* collisionConfiguration,
+                                                             WorkerPool& workerPool)
+        : btCollisionDispatcher(collisionConfiguration),
+          workerPool(workerPool) {
+    }
+
+    btPersistentManifold* ParallelCollisionDispatcher::getNewManifold(const btCollisionObject* body0,
+                                                                      const btCollisionObject* body1) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return btCollisionDispatcher::getNewManifold(body0, body1);
+    }
+
+    void ParallelCollisionDispatcher::releaseManifold(btPersistentManifold* manifold) {
+        std::lock_guard<std::mutex> lock(mutex);
+        btCollisionDispatcher::releaseManifold(manifold);
+    }
+
+    void* ParallelCollisionDispatcher::allocateCollisionAlgorithm(int size) {
+        // Concave pairs create and free an algorithm per triangle, which shouldn't wait for the lock
+        if (isDispatchingInParallel) {
+            return btAlignedAlloc(static_cast<size_t>(size), 16);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        return btCollisionDispatcher::allocateCollisionAlgorithm(size);
+    }
+
+    void ParallelCollisionDispatcher::freeCollisionAlgorithm(void* ptr) {
+        if (!m_collisionAlgorithmPoolAllocator->validPtr(ptr)) {
+            btAlignedFree(ptr);
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        m_collisionAlgorithmPoolAllocator->freeMemory(ptr);
+    }
+
+    void ParallelCollisionDispatcher::dispatchAllCollisionPairs(btOverlappingPairCache* pairCache,
+                                                                const btDispatcherInfo& dispatchInfo,
+                                                                btDispatcher* dispatcher) {
+        auto& pairs = pairCache->getOverlappingPairArray();
+        auto numPairs = pairs.size();
+        if (workerPool.getNumThreads() == 0 || numPairs <= PairsPerTask) {
+            btCollisionDispatcher::dispatchAllCollisionPairs(pairCache, dispatchInfo, dispatcher);
+            return;
+        }
+
+        // The near callback never removes pairs, so the array stays as it is while the workers use it.
+        // New manifolds are appended in whatever order the threads get to them.
+        auto nearCallback = getNearCallback();
+        auto numTasks = static_cast<size_t>((numPairs + PairsPerTask - 1) / PairsPerTask);
+        isDispatchingInParallel = true;
+        workerPool.parallelFor(numTasks, [&](size_t task) {
+            auto begin = static_cast<int>(task) * PairsPerTask;
+            auto end = std::min(begin + PairsPerTask, numPairs);
+            for (auto i = begin; i < end; i++) {
+                nearCallback(pairs[i], *this, dispatchInfo);
+            }
+        });
+        isDispatchingInParallel = false;
+    }
+}
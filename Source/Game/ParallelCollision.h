@@ -0,0 +1,39 @@
+#pragma once
+
+#include <mutex>
+
+#include <btBulletCollisionCommon.h>
+
+namespace tankwars {
+    class WorkerPool;
+
+    // Like btDefaultCollisionConfiguration, but every convex-convex collision algorithm has its own simplex
+    // solver instead of sharing the configuration's one, so pairs can be processed on several threads
+    class ParallelCollisionConfiguration : public btDefaultCollisionConfiguration {
+    public:
+        ParallelCollisionConfiguration();
+    };
+
+    // Runs the narrowphase of the overlapping pairs on a worker pool. Bullet 2.84 has no multithreaded
+    // dynamics world, so the broadphase, the islands and the solver still run on the stepping thread.
+    // Everything the narrowphase calls while the pairs are processed must be thread-safe, so no
+    // gContactAddedCallback and only the collision algorithms of a ParallelCollisionConfiguration.
+    class ParallelCollisionDispatcher : public btCollisionDispatcher {
+    public:
+        // With a pool without threads, the pairs are processed on the calling thread like before
+        ParallelCollisionDispatcher(ParallelCollisionConfiguration* collisionConfiguration, WorkerPool& workerPool);
+
+        btPersistentManifold* getNewManifold(const btCollisionObject* body0, const btCollisionObject* body1) override;
+        void releaseManifold(btPersistentManifold* manifold) override;
+        void* allocateCollisionAlgorithm(int size) override;
+        void freeCollisionAlgorithm(void* ptr) override;
+
+        void dispatchAllCollisionPairs(btOverlappingPairCache* pairCache, const btDispatcherInfo& dispatchInfo,
+                                       btDispatcher* dispatcher) override;
+
+    private:
+        WorkerPool& workerPool;
+        std::mutex mutex;                   // Guards the manifold list and the pools
+        bool isDispatchingInParallel = false;
+    };
+}
@@ -334,6 +334,10 @@ namespace tankwars {
         glUniformMatrix4fv(genShadowMapViewProjMatrixLocation, 1, GL_FALSE, glm::value_ptr(lightMatrix));
 
         for (auto sceneObject : sceneObjects) {
+            if (!sceneObject->visible) {
+                continue;
+            }
+
             glUniformMatrix4fv(genShadowMapModelMatrixLocation, 1, GL_FALSE, glm::value_ptr(sceneObject->modelMatrix));
             sceneObject->mesh->render();
         }
@@ -354,6 +358,10 @@ namespace tankwars {
         terrain->render();
 
         for (auto sceneObject : sceneObjects) {
+            if (!sceneObject->visible) {
+                continue;
+            }
+
             glUniformMatrix4fv(outlineModelMatrixLocation, 1, GL_FALSE, glm::value_ptr(sceneObject->modelMatrix));
             sceneObject->mesh->render();
         }
@@ -408,6 +416,10 @@ namespace tankwars {
         glBindTexture(GL_TEXTURE_2D, shadowMap);
 
         for (auto sceneObject : sceneObjects) {
+            if (!sceneObject->visible) {
+                continue;
+            }
+
             assert(sceneObject->mesh);
             assert(sceneObject->material);
 
@@ -1,28 +1,62 @@
 #include "Tank.h"
 
+#include <cstdint>
+
 #include <glm/gtc/type_ptr.hpp>
 
 #include "Renderer.h"
+#include "BallisticProjectiles.h"
+#include "CollisionEvents.h"
+#include "VoxelVehicleRaycaster.h"
+
+namespace {
+	// In seconds, turned into ticks of the game clock
+	constexpr double TimeBetweenEngineDecreases = 0.1;
+	constexpr double TimeBetweenShots = 0.5;
+	constexpr double TimeBetweenPowerAdjusts = 0.001;
+	constexpr double TimeBetweenCameraMovementChanges = 0.01;
+	constexpr double TimeBetweenShootingModeToggles = 0.5;
+
+	// The head turns on top of the chassis and the turret tilts in front of the head
+	glm::mat4 getHeadMatrix(const glm::mat4& chassisMatrix, float headAndTurretAngle) {
+		return glm::translate(glm::rotate(chassisMatrix, headAndTurretAngle, glm::vec3(0, 1, 0)), glm::vec3(0, 2, 0));
+	}
+
+	glm::mat4 getTurretMatrix(const glm::mat4& headMatrix, float turretAngle) {
+		return glm::translate(glm::rotate(headMatrix, turretAngle, glm::vec3(1, 0, 0)), glm::vec3(0, 0, -1));
+	}
+}
 
 namespace tankwars {
 
-	Tank::Tank(btDiscreteDynamicsWorld *dynamicsWorld, Renderer& renderer, btVector3 startingPosition,int tankID)
+	Tank::Tank(btDiscreteDynamicsWorld *dynamicsWorld, Renderer& renderer, const VoxelTerrain& terrain,
+		const GameClock& clock, btVector3 startingPosition, int tankID, size_t bulletPoolSize, BallisticProjectiles* ballisticProjectiles)
 		: wheelDirection(0, -1, 0),
 		  wheelAxle(-1, 0, 0),
 		  renderer(&renderer),
 		  dynamicsWorld(dynamicsWorld),
-		  bulletHandler(dynamicsWorld, renderer,tankID),
+		  bulletHandler(dynamicsWorld, renderer, tankID, bulletPoolSize, ballisticProjectiles),
 		  tankTuning(),
 		  tankBoxShape(new btBoxShape(btVector3(1.5f, .3f, 2.f))),
 		  tankSmallBoxShape(new btBoxShape(btVector3(0.04f, 0.04f, 0.04f))),
-		  tankID(tankID)
+		  tankID(tankID),
+		  engineDecreaseCooldown(clock.fromSeconds(TimeBetweenEngineDecreases)),
+		  shotCooldown(clock.fromSeconds(TimeBetweenShots)),
+		  powerAdjustCooldown(clock.fromSeconds(TimeBetweenPowerAdjusts)),
+		  cameraMovementCooldown(clock.fromSeconds(TimeBetweenCameraMovementChanges)),
+		  shootingModeToggleCooldown(clock.fromSeconds(TimeBetweenShootingModeToggles))
 		  //dirtTexture(tankwars::createTextureFromFile("Content/Textures/Dreck.png")),
 		  //dirtParticleSystem(512,dirtTexture)
 	{
 		//setTankTuning();
 		//tr.setIdentity();s
 
-		tankMotionState.reset(new btDefaultMotionState(btTransform(btQuaternion(0, 0, 0, 1), startingPosition)));
+		chassisTransform = btTransform(btQuaternion(0, 0, 0, 1), startingPosition);
+		previousChassisTransform = chassisTransform;
+		for (auto& wheelTransform : wheelTransforms) {
+			wheelTransform.setIdentity();
+		}
+		tankMotionState.reset(new btDefaultMotionState(chassisTransform));
 
         // Use a compound shape so we can set a different center of mass.
         // (0, 1, 0) means that the center of mass is at (0, -1, 0) which makes the tank more stable.
@@ -36,7 +70,8 @@ namespace tankwars {
 
 		tankChassis.reset(new btRigidBody(tankRigidBodyCI));
 		dynamicsWorld->addRigidBody(tankChassis.get());
-		tankVehicleRaycaster.reset(new btDefaultVehicleRaycaster(dynamicsWorld));
+		// The wheels are cast against the voxels, so they don't depend on the terrain's collision shapes
+		tankVehicleRaycaster.reset(new VoxelVehicleRaycaster(terrain, dynamicsWorld));
 		tank.reset(new btRaycastVehicle(tankTuning, tankChassis.get(), tankVehicleRaycaster.get()));
 		tank->setCoordinateSystem(0, 1, 2);
 		tankChassis->setActivationState(DISABLE_DEACTIVATION);
@@ -100,6 +135,8 @@ namespace tankwars {
 		tankModelMat = glm::translate(glm::mat4(1), glm::vec3(startPos.getX(), startPos.getY(), startPos.getZ()));
 		tankModelMat = glm::scale(tankModelMat, glm::vec3(8, 8, 8));
 		tankModelMat = glm::rotate(tankModelMat, glm::pi<float>(), glm::vec3(0, 1, 0));
+		headModelMat = tankModelMat;
+		turretModelMat = tankModelMat;
 
 		//MeshInstances
         tankMeshInstances.reserve(7);
@@ -170,6 +207,15 @@ namespace tankwars {
 	}
 
 	glm::vec3 Tank::getDirectionVector() {
+		return -glm::vec3(headModelMat[2][0], 0, headModelMat[2][2]);
+	}
+
+	glm::vec3 Tank::getRenderPosition() {
+		const auto& chassisMatrix = tankMeshInstances[0].modelMatrix;
+		return glm::vec3(chassisMatrix[3][0], chassisMatrix[3][1], chassisMatrix[3][2]);
+	}
+
+	glm::vec3 Tank::getRenderDirectionVector() {
 		return -glm::vec3(tankMeshInstances[1].modelMatrix[2][0], 0, tankMeshInstances[1].modelMatrix[2][2]);
 	}
 
@@ -186,14 +232,13 @@ namespace tankwars {
 	void Tank::addPoint() {
 		points++;
 	}
-	void Tank::toggleShootingMode(btScalar dt){
-		if (dt - lastShootinModeToggle > timeBetweenShootingModeToggles) {
+	void Tank::toggleShootingMode(){
+		if (shootingModeToggleCooldown.tryStart()) {
 			shootingModeOn = !shootingModeOn;
-			lastShootinModeToggle = dt;
 		}
 	}
-	void Tank::moveCam(bool further, btScalar dt) {
-		if (!shootingModeOn && (dt - lastCameraMovementChange > timeBetweenCameraMovementChanges)) {
+	void Tank::moveCam(bool further) {
+		if (!shootingModeOn && cameraMovementCooldown.tryStart()) {
 			if (further) {
 				if (cameraOffsetDistance < 13) {
 					cameraOffsetDistance += 0.04f;
@@ -210,7 +255,6 @@ namespace tankwars {
 					cameraOffsetHeight -= 0.03f;
 				}
 			}
-			lastCameraMovementChange = dt;
 		}
 	}
 	btScalar Tank::getCameraOffsetDistance() {
@@ -228,12 +272,12 @@ namespace tankwars {
 	btScalar Tank::getShootingPowerInSteps() {
 		return (shootingPower - shootingPowerMin) / shootingPowerIncrease;
 	}
-	btScalar Tank::getShootingTimerRestInSteps(btScalar dt) {
-		btScalar temp = dt - lastTimeShot;
-		btScalar step = timeBetweenShots / 100;
-		int i;
-		for ( i = 0; i*step < temp; i++) {}
-		return static_cast<btScalar>(i);
+	btScalar Tank::getShootingTimerRestInSteps() {
+		auto duration = shotCooldown.getDuration();
+		if (duration == 0) {
+			return 100;
+		}
+		return static_cast<btScalar>((duration - shotCooldown.getRemaining()) * 100 / duration);
 	}
 	//-------------------------------------------Controller-Functions----------------------------
 
@@ -256,6 +300,9 @@ namespace tankwars {
 		trans.setFromOpenGLMatrix(glm::value_ptr(tankModelMat));
 		tankChassis->getMotionState()->setWorldTransform(trans);
 		tankChassis->setMotionState(tankMotionState.get());
+		// Teleported, so there is nothing to interpolate from
+		chassisTransform = trans;
+		previousChassisTransform = trans;
 		tankChassis->setLinearVelocity(btVector3(0, 0, 0));
 		tankChassis->setAngularVelocity(btVector3(0, 0, 0));
 		turretAngle = 0;
@@ -304,17 +351,16 @@ namespace tankwars {
 		tankSteering = steeringClamp*val;
 	}
 
-	void Tank::shoot(float dt) {
-		if (dt - lastTimeShot > timeBetweenShots) {
+	void Tank::shoot() {
+		if (shotCooldown.tryStart()) {
 			btTransform trans;
-			trans.setFromOpenGLMatrix(glm::value_ptr(tankMeshInstances[2].modelMatrix));
+			trans.setFromOpenGLMatrix(glm::value_ptr(turretModelMat));
 
-			bulletHandler.createNewBullet(trans,glm::vec3(tankMeshInstances[0].modelMatrix[2][0], tankMeshInstances[0].modelMatrix[2][1], tankMeshInstances[0].modelMatrix[2][2]),tank->getCurrentSpeedKmHour());
-			lastTimeShot = dt;
+			bulletHandler.createNewBullet(trans,glm::vec3(tankModelMat[2][0], tankModelMat[2][1], tankModelMat[2][2]),tank->getCurrentSpeedKmHour());
 		}
 	}
-	void Tank::adjustPower(bool increase, float dt) {
-		if (dt - lastPowerAdjust > timeBetweenPowerAdjusts) {
+	void Tank::adjustPower(bool increase) {
+		if (powerAdjustCooldown.tryStart()) {
 			if (increase) {
 				if (shootingPower < shootingPowerMax)
 					shootingPower += shootingPowerIncrease;
@@ -323,7 +369,6 @@ namespace tankwars {
 				if (shootingPower > shootingPowerMin)
 					shootingPower -= shootingPowerIncrease;
 			}
-			lastPowerAdjust = dt;
 			bulletHandler.updatePower(shootingPower);
 		}
 	}
@@ -366,11 +411,17 @@ namespace tankwars {
 		}
 	}
 
-	void Tank::update(float dt) {
+	void Tank::update(Ticks elapsed) {
+		engineDecreaseCooldown.advance(elapsed);
+		shotCooldown.advance(elapsed);
+		powerAdjustCooldown.advance(elapsed);
+		cameraMovementCooldown.advance(elapsed);
+		shootingModeToggleCooldown.advance(elapsed);
+
 		//std::cout << tank->getCurrentSpeedKmHour() <<"\n";
-		btTransform trans;
-		tankChassis->getMotionState()->getWorldTransform(trans);
-		trans.getOpenGLMatrix(glm::value_ptr(tankModelMat));
+		previousChassisTransform = chassisTransform;
+		tankChassis->getMotionState()->getWorldTransform(chassisTransform);
+		chassisTransform.getOpenGLMatrix(glm::value_ptr(tankModelMat));
         /*
 		if (tank->getCurrentSpeedKmHour()) {
 			if (tank->getWheelInfo(0).m_raycastInfo.m_groundObject) {
@@ -405,7 +456,7 @@ namespace tankwars {
 		else if(tankEngineForce>0 && tank->getCurrentSpeedKmHour()>0) {
 			tankEngineForce -= std::abs(pow(tank->getCurrentSpeedKmHour(), 3))*dragCoefficient;
 		}
-		if (dt - lastTimeEngineDecreased > timeBetweenEngineDecreases) {
+		if (engineDecreaseCooldown.tryStart()) {
 			if (tankEngineForce > 0) {
 				tankEngineForce -= engineForceReduceFactor;
 				if (tankEngineForce < 0) {
@@ -418,7 +469,6 @@ namespace tankwars {
 					tankEngineForce = 0;
 				}
 			}
-			lastTimeEngineDecreased = dt;
 		}
 		tank->resetSuspension();
 		for (int i = 0; i < 4; i++) {
@@ -439,35 +489,70 @@ namespace tankwars {
 
 		
 
-		for (MeshInstance& mI : tankMeshInstances) {
-			mI.modelMatrix = tankModelMat;
-		}
-		glm::vec3 rightVec = glm::normalize(glm::vec3(tankModelMat[0][0], 0, tankModelMat[0][2]));
-		glm::vec3 upVec = glm::normalize(glm::vec3(tankModelMat[1][0], tankModelMat[1][1], tankModelMat[1][2]));
-		tankMeshInstances[1].modelMatrix = glm::translate(glm::rotate(tankModelMat, headAndTurretAngle, glm::vec3(0,1,0)),glm::vec3(0,2,0));//HeadAndCanonRotationAngle 
-		tankMeshInstances[2].modelMatrix = glm::translate(glm::rotate(tankMeshInstances[1].modelMatrix, turretAngle, glm::vec3(1, 0, 0)), glm::vec3(0, 0, -1));
+		headModelMat = getHeadMatrix(tankModelMat, headAndTurretAngle);//HeadAndCanonRotationAngle 
+		turretModelMat = getTurretMatrix(headModelMat, turretAngle);
 
 		for (int i = 0; i < 4; i++) {
-			tank->getWheelInfo(i).m_worldTransform.getOpenGLMatrix(glm::value_ptr(tankModelMat));
-			tankMeshInstances[i + 3].modelMatrix = tankModelMat;
+			wheelTransforms[i] = chassisTransform.inverseTimes(tank->getWheelInfo(i).m_worldTransform);
 		}
 		btTransform transi;
-		transi.setFromOpenGLMatrix(glm::value_ptr(tankMeshInstances[2].modelMatrix));
-		bulletHandler.updateBullets(dt,transi);
+		transi.setFromOpenGLMatrix(glm::value_ptr(turretModelMat));
+		bulletHandler.updateBullets(transi);
 	}
 
-	Tank::BulletHandler::BulletHandler(btDynamicsWorld* dynamicsWorld, Renderer& renderer,int tankId)
+	void Tank::interpolate(float alpha) {
+		btTransform trans(previousChassisTransform.getRotation().slerp(chassisTransform.getRotation(), alpha),
+			previousChassisTransform.getOrigin().lerp(chassisTransform.getOrigin(), alpha));
+		glm::mat4 chassisMatrix;
+		trans.getOpenGLMatrix(glm::value_ptr(chassisMatrix));
+		tankMeshInstances[0].modelMatrix = chassisMatrix;
+		tankMeshInstances[1].modelMatrix = getHeadMatrix(chassisMatrix, headAndTurretAngle);
+		tankMeshInstances[2].modelMatrix = getTurretMatrix(tankMeshInstances[1].modelMatrix, turretAngle);
+
+		// The wheels keep their place on the chassis of the last tick
+		for (int i = 0; i < 4; i++) {
+			(trans * wheelTransforms[i]).getOpenGLMatrix(glm::value_ptr(tankMeshInstances[i + 3].modelMatrix));
+		}
+
+		bulletHandler.interpolateBullets(alpha);
+	}
+
+	Tank::BulletHandler::BulletHandler(btDynamicsWorld* dynamicsWorld, Renderer& renderer, int tankId, size_t poolSize,
+		BallisticProjectiles* ballisticProjectiles)
             : dynamicsWorld(dynamicsWorld),
 			  renderer(renderer),
+			  ballisticProjectiles(ballisticProjectiles),
 			  bulletMesh(createSphereMesh(0.1f, 5, 5)),
 			  bulletShape(0.1f), 
-			  tankID(tankId) {
+			  tankID(tankId),
+			  bullets(poolSize) {
 		bulletMat.diffuseColor = { 0.6f, 0.6f, 0 };
 		bulletMat.specularColor = { 1, 0, 0 };
 		bulletMat.specularExponent = 16;
 		bulletInertia = btVector3(0, 0, 0);
-		for (int i = 0; i < bulletMax;i++) {
-			bullets.at(i).set(tankId, MeshInstance(bulletMesh, bulletMat));
+		freeBullets.reserve(poolSize);
+		activeBullets.reserve(poolSize);
+
+		for (size_t i = 0; i < poolSize; i++) {
+			auto& bullet = bullets[i];
+			bullet.owner = tankId;
+			bullet.bulletMeshInstance = MeshInstance(bulletMesh, bulletMat);
+			bullet.bulletMeshInstance.visible = false;
+			renderer.addSceneObject(bullet.bulletMeshInstance);
+			freeBullets.push_back(poolSize - 1 - i);
+			if (ballisticProjectiles) {
+				continue;
+			}
+
+			// The bodies wait in the world without being simulated or colliding with anything
+			bullet.motionState.reset(new btDefaultMotionState);
+			bullet.bulletBody.reset(new btRigidBody(mass, bullet.motionState.get(), &bulletShape, bulletInertia));
+			setCollisionCategory(*bullet.bulletBody, CollisionCategory::Bullet);
+			bullet.bulletBody->setUserPointer(&bullet);
+			bullet.bulletBody->setCcdMotionThreshold(0.2f);
+			bullet.bulletBody->setCcdSweptSphereRadius(0.1f);
+			bullet.bulletBody->forceActivationState(DISABLE_SIMULATION);
+			dynamicsWorld->addRigidBody(bullet.bulletBody.get(), btBroadphaseProxy::DefaultFilter, 0);
 		}
 		/*for (int i = 0; i < bulletRaycastMax; i++) {
 			raycastBullets.at(i).set(tankId, MeshInstance(bulletMesh, bulletMat));
@@ -478,40 +563,71 @@ namespace tankwars {
 		power = pwr;
 	}
 	void Tank::BulletHandler::createNewBullet(btTransform& tr,glm::vec3 drivingDirection,btScalar drivingSpeed) {
+		if (freeBullets.empty()) {
+			return;
+		}
+
 		glm::mat4 bulletMatrix;
 		tr.getOpenGLMatrix(glm::value_ptr(bulletMatrix));
 		drivingDirection = glm::normalize(drivingDirection);
-		for (int i = 0; i < bulletMax; i++) {
-			if (!bullets.at(i).active) {
-				bullets.at(i).set(new btRigidBody(mass, new btDefaultMotionState(tr), &bulletShape, bulletInertia));
-				bullets.at(i).bulletBody->setLinearVelocity(btVector3(drivingDirection[0], drivingDirection[1], drivingDirection[2])*drivingSpeed*0.1f-btVector3(bulletMatrix[2][0], bulletMatrix[2][1], bulletMatrix[2][2])*power);
-				bullets.at(i).bulletBody->setCollisionFlags(bullets.at(i).bulletBody->getCollisionFlags() | btCollisionObject::CF_CUSTOM_MATERIAL_CALLBACK);
-				bullets.at(i).bulletBody->setUserIndex(10);
-				bullets.at(i).bulletBody->setUserPointer(&bullets.at(i));
-				bullets.at(i).bulletBody->setCcdMotionThreshold(0.2f);
-				bullets.at(i).bulletBody->setCcdSweptSphereRadius(0.1f);
-				bullets.at(i).active = true;
-				bullets.at(i).disableMe = false;
-				dynamicsWorld->addRigidBody(bullets.at(i).bulletBody.get());
-				renderer.addSceneObject(bullets.at(i).bulletMeshInstance);
+		auto velocity = btVector3(drivingDirection[0], drivingDirection[1], drivingDirection[2])*drivingSpeed*0.1f-btVector3(bulletMatrix[2][0], bulletMatrix[2][1], bulletMatrix[2][2])*power;
+
+		auto index = freeBullets.back();
+		auto& bullet = bullets[index];
+		if (ballisticProjectiles) {
+			bullet.projectile = ballisticProjectiles->spawn(glm::vec3(tr.getOrigin().x(), tr.getOrigin().y(), tr.getOrigin().z()),
+				glm::vec3(velocity.x(), velocity.y(), velocity.z()), tankID, &bullet);
+			if (bullet.projectile == SIZE_MAX) {
 				return;
 			}
 		}
-	}
 
-	void Tank::BulletHandler::updateBullets(btScalar dt,btTransform direction) {
-		glm::mat4 bulletMat;
+		freeBullets.pop_back();
+		bullet.activeIndex = activeBullets.size();
+		activeBullets.push_back(index);
+		bullet.active = true;
+		bullet.disableMe = false;
+		bullet.previousPosition = glm::vec3(bulletMatrix[3]);
+		bullet.position = bullet.previousPosition;
+		bullet.bulletMeshInstance.modelMatrix = bulletMatrix;
+		bullet.bulletMeshInstance.visible = true;
+		if (ballisticProjectiles) {
+			return;
+		}
+
+		// Reset everything the last flight left behind, including the interpolation the motion state is updated from
+		auto body = bullet.bulletBody.get();
+		body->setWorldTransform(tr);
+		body->setInterpolationWorldTransform(tr);
+		body->setLinearVelocity(velocity);
+		body->setInterpolationLinearVelocity(velocity);
+		body->setAngularVelocity(btVector3(0, 0, 0));
+		body->setInterpolationAngularVelocity(btVector3(0, 0, 0));
+		body->clearForces();
+		bullet.motionState->setWorldTransform(tr);
+		body->forceActivationState(ACTIVE_TAG);
+		body->setDeactivationTime(0);
+		body->getBroadphaseHandle()->m_collisionFilterMask = btBroadphaseProxy::AllFilter;
+		dynamicsWorld->updateSingleAabb(body);
+	}
+
+	void Tank::BulletHandler::updateBullets(btTransform direction) {
 		btTransform trans;
 		//bool shotABulletThisTick = false;
-		for (int i = 0; i < bulletMax;i++) {
-			if (bullets.at(i).disableMe) {
-				removeBullet(i);
+		// Backwards, so removing a bullet only moves ones that were already updated
+		for (size_t i = activeBullets.size(); i-- > 0;) {
+			auto& bullet = bullets[activeBullets[i]];
+			if (bullet.disableMe) {
+				removeBullet(activeBullets[i]);
 			}
-			else if(bullets.at(i).active){
-				bullets.at(i).bulletBody->setUserPointer(&bullets.at(i));
-				bullets.at(i).bulletBody->getMotionState()->getWorldTransform(trans);
-				trans.getOpenGLMatrix(glm::value_ptr(bulletMat));
-				bullets.at(i).bulletMeshInstance.modelMatrix = bulletMat;
+			else if (ballisticProjectiles) {
+				bullet.previousPosition = bullet.position;
+				bullet.position = ballisticProjectiles->getPosition(bullet.projectile);
+			}
+			else {
+				bullet.motionState->getWorldTransform(trans);
+				bullet.previousPosition = bullet.position;
+				bullet.position = glm::vec3(trans.getOrigin().x(), trans.getOrigin().y(), trans.getOrigin().z());
 				//shotABulletThisTick = true;
 			}
 		}
@@ -543,10 +659,49 @@ namespace tankwars {
 		}*/
 	}
 
-	void Tank::BulletHandler::removeBullet(int index) {
-		dynamicsWorld->removeRigidBody(bullets.at(index).bulletBody.get());
-		renderer.removeSceneObject(bullets.at(index).bulletMeshInstance);
-		bullets.at(index).active = false;
+	void Tank::BulletHandler::interpolateBullets(float alpha) {
+		// The bullets are spheres, so only their position matters
+		for (auto index : activeBullets) {
+			auto& bullet = bullets[index];
+			bullet.bulletMeshInstance.modelMatrix = glm::translate(glm::mat4(1), glm::mix(bullet.previousPosition, bullet.position, alpha));
+		}
+	}
+
+	void Tank::BulletHandler::removeBullet(size_t index) {
+		auto& bullet = bullets[index];
+		if (!bullet.active) {
+			return;
+		}
+
+		bullet.active = false;
+		bullet.bulletMeshInstance.visible = false;
+
+		// Swap the last active bullet into the removed one's place
+		auto last = activeBullets.back();
+		activeBullets[bullet.activeIndex] = last;
+		bullets[last].activeIndex = bullet.activeIndex;
+		activeBullets.pop_back();
+		freeBullets.push_back(index);
+
+		if (ballisticProjectiles) {
+			// After an impact, the projectile is already gone and its slot may belong to another bullet
+			if (!bullet.disableMe) {
+				ballisticProjectiles->remove(bullet.projectile);
+			}
+
+			bullet.disableMe = false;
+			return;
+		}
+
+		auto body = bullet.bulletBody.get();
+		body->forceActivationState(DISABLE_SIMULATION);
+		body->setLinearVelocity(btVector3(0, 0, 0));
+		body->setAngularVelocity(btVector3(0, 0, 0));
+		// Without its pairs, the bullet can't touch whatever it hit while it is parked there
+		body->getBroadphaseHandle()->m_collisionFilterMask = 0;
+		dynamicsWorld->getBroadphase()->getOverlappingPairCache()->removeOverlappingPairsContainingProxy(
+			body->getBroadphaseHandle(), dynamicsWorld->getDispatcher());
+		bullet.disableMe = false;
 	}
 	/*void Tank::BulletHandler::removeRaycastBullet(int index) {
 		dynamicsWorld->removeRigidBody(raycastBullets.at(index).bulletBody.get());
@@ -555,9 +710,14 @@ namespace tankwars {
 	}*/
 	Tank::BulletHandler::~BulletHandler() {
         for (auto& bullet : bullets) {
-            if (bullet.bulletBody) {
+            if (ballisticProjectiles && bullet.active && !bullet.disableMe) {
+                ballisticProjectiles->remove(bullet.projectile);
+            }
+            else if (bullet.bulletBody) {
                 dynamicsWorld->removeRigidBody(bullet.bulletBody.get());
             }
+
+            renderer.removeSceneObject(bullet.bulletMeshInstance);
         }
 
        /* for (auto& bullet : raycastBullets) {
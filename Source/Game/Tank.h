@@ -14,30 +14,47 @@
 #include "Wavefront.h"
 #include "Mesh.h"
 #include "MeshInstance.h"
+#include "GameClock.h"
 #include "MeshTools.h" // Won't be needed in the final version
 //#include "GLTools.h"
 //#include "ParticleSystem.h"
 
 namespace tankwars {
     class Renderer;
+    class VoxelTerrain;
+    class BallisticProjectiles;
 
 	class Tank {
 	public:
+		// A pooled projectile. Its body stays in the world and its mesh instance in the scene,
+		// both are only switched off while the bullet is not in flight.
+		// Ballistic bullets have no body, they fly in the shared BallisticProjectiles instead.
 		struct Bullet {
-			void set(int own, MeshInstance inst) { owner = own; bulletMeshInstance = inst; }
-			void set(btRigidBody* body) { bulletBody.reset(body); }
             bool active = false;
 			bool disableMe = false;
 			int owner;
+			size_t activeIndex = 0; // Position in the handler's list of active bullets
+			size_t projectile = 0;  // Slot in the ballistic projectiles
+			glm::vec3 previousPosition; // At the last two ticks, the mesh is drawn in between
+			glm::vec3 position;
+			std::unique_ptr<btMotionState> motionState;
 			std::unique_ptr<btRigidBody> bulletBody;
 			MeshInstance bulletMeshInstance;
 		};
 
-		Tank(btDiscreteDynamicsWorld *dynamicsWorld, Renderer& renderer, btVector3 startingPosition, int tankID);
+		// bulletPoolSize is the number of bullets the tank can have in flight at once. With ballistic
+		// projectiles, the bullets are traced by them instead of being simulated as rigid bodies.
+		// The clock's tick rate sets the length of the tank's cooldowns.
+		Tank(btDiscreteDynamicsWorld *dynamicsWorld, Renderer& renderer, const VoxelTerrain& terrain,
+			const GameClock& clock, btVector3 startingPosition, int tankID, size_t bulletPoolSize,
+			BallisticProjectiles* ballisticProjectiles = nullptr);
         ~Tank();
 
 		void addWheels();
-		void update(float dt);
+		// Runs once per simulation tick, after the physics. Takes the ticks since the last update.
+		void update(Ticks elapsed);
+		// Places the meshes between the last two ticks, alpha goes from the previous tick to the last one
+		void interpolate(float alpha);
 		void turn(bool left);
 		void drive(bool forward);
 		void driveBack(bool backward);
@@ -46,12 +63,16 @@ namespace tankwars {
 		btRaycastVehicle* getAction();
 		MeshInstance* getTankMeshInstance(int i);
 		glm::vec3 getPosition();
+		// Where the tank is drawn, for following it with a camera
+		glm::vec3 getRenderPosition();
+		glm::vec3 getRenderDirectionVector();
 		btRigidBody* getRigidBody();
 
 		btScalar getShootingPowerInSteps();
-		btScalar getShootingTimerRestInSteps(btScalar dt);
+		// From 0 right after a shot to 100 when the tank can shoot again
+		btScalar getShootingTimerRestInSteps();
 
-		void moveCam(bool closer, btScalar dt);
+		void moveCam(bool closer);
 		btScalar getCameraOffsetDistance();
 		btScalar getCameraOffsetHeight();
 
@@ -61,13 +82,13 @@ namespace tankwars {
 		void turnController(float val);
 		void turnTurretController(float val);
 		void turnHeadAndTurretController(float val);
-		void shoot(float dt);
-		void adjustPower(bool increase, float dt);
+		void shoot();
+		void adjustPower(bool increase);
 		int tankID;
 		void reset(glm::vec3 position, glm::vec3 lookAt);
 		void addPoint();
 		int getPoints();
-		void toggleShootingMode(btScalar dt);
+		void toggleShootingMode();
 		int getSpeed();
 	private:
 		//GLuint dirtTexture;
@@ -83,14 +104,21 @@ namespace tankwars {
         std::unique_ptr<btCompoundShape> compoundShape;
 		std::unique_ptr<btMotionState> tankMotionState;
         std::unique_ptr<btRigidBody> tankChassis;
-        std::unique_ptr<btDefaultVehicleRaycaster> tankVehicleRaycaster;
+        std::unique_ptr<btVehicleRaycaster> tankVehicleRaycaster;
         std::unique_ptr<btRaycastVehicle> tank;
 
 		btRaycastVehicle::btVehicleTuning tankTuning;
         
 
+		// The chassis at the last two ticks and the wheels relative to it at the last one
+		btTransform previousChassisTransform;
+		btTransform chassisTransform;
+		btTransform wheelTransforms[4];
+
 		//Tank Meshes and MeshInstances
 		glm::mat4x4 tankModelMat;
+		glm::mat4x4 headModelMat;   // At the last tick, the mesh instances are interpolated
+		glm::mat4x4 turretModelMat;
 		Material tankMaterial;
         std::unique_ptr<Mesh> tankBodyMesh;
         std::unique_ptr<Mesh> tankHeadMesh;
@@ -105,14 +133,10 @@ namespace tankwars {
 		
 		//End Tank Meshes and MeshInstances
 
-		// timing Variables
-		float lastTimeEngineDecreased = 0;
-		float timeBetweenEngineDecreases = 0.1f;
-		float lastTimeShot = 0;
-		float timeBetweenShots = .5f;
-
-		float lastPowerAdjust = 0;
-		float timeBetweenPowerAdjusts = 0.001f;
+		// timing Variables, in ticks of the game clock
+		Cooldown engineDecreaseCooldown;
+		Cooldown shotCooldown;
+		Cooldown powerAdjustCooldown;
 		//Tank Physics Variables
 		float dragCoefficient = .03f;
 
@@ -152,21 +176,22 @@ namespace tankwars {
 
 		btScalar cameraOffsetDistance = 10.f;
 		btScalar cameraOffsetHeight = 5.f;
-		btScalar lastCameraMovementChange = 0;
-		btScalar timeBetweenCameraMovementChanges = 0.01f;
+		Cooldown cameraMovementCooldown;
 		bool shootingModeOn = false;
-		btScalar lastShootinModeToggle = 0;
-		btScalar timeBetweenShootingModeToggles = 0.5f;
+		Cooldown shootingModeToggleCooldown;
 		//End Tank Movement Variables
 
 		class BulletHandler {
 		public:
-			BulletHandler(btDynamicsWorld* dynamicsWorld, Renderer& renderer, int tankId);
+			// All bullets are created up front, firing and removing them doesn't allocate
+			BulletHandler(btDynamicsWorld* dynamicsWorld, Renderer& renderer, int tankId, size_t poolSize,
+				BallisticProjectiles* ballisticProjectiles);
             ~BulletHandler();
 
 			void createNewBullet(btTransform& tr, glm::vec3 drivingDirection, btScalar drivingSpeed);
-			void updateBullets(btScalar dt, btTransform direction);
-			void removeBullet(int index);
+			void updateBullets(btTransform direction);
+			void interpolateBullets(float alpha);
+			void removeBullet(size_t index);
 			void updatePower(btScalar pwr);
 
 		private:
@@ -177,10 +202,13 @@ namespace tankwars {
 			int tankID;
 			btDynamicsWorld* dynamicsWorld;
 			Renderer& renderer;
+			BallisticProjectiles* ballisticProjectiles;
 			btSphereShape bulletShape;
 			Mesh bulletMesh;
-			size_t bulletMax = 20;
-			std::array<Bullet, 20> bullets;
+			// Never resized after construction, the bodies and the renderer point into it
+			std::vector<Bullet> bullets;
+			std::vector<size_t> freeBullets;
+			std::vector<size_t> activeBullets;
 			//size_t bulletRaycastMax = 500;
 			//std::array<Bullet, 500> raycastBullets;
 			//btScalar lastTimeBulletRaycastShot = 0;
@@ -0,0 +1,163 @@
+#include "VoxelRaycaster.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "MarchingCubes.h"
+#include "VoxelTerrain.h"
+
+namespace tankwars {
+    // The corners of a cell in the order marching cubes expects them
+    const int CellCorners[8][3] = {
+        {0, 0, 1}, {1, 0, 1}, {1, 0, 0}, {0, 0, 0},
+        {0, 1, 1}, {1, 1, 1}, {1, 1, 0}, {0, 1, 0}
+    };
+
+    VoxelRaycaster::VoxelRaycaster(const VoxelTerrain& terrain)
+        : terrain(terrain) {
+    }
+
+    bool VoxelRaycaster::castRay(const btVector3& from, const btVector3& to, btScalar& outFraction, btVector3& outNormal) {
+        // The voxels' z axis points the other way
+        btVector3 origin(from.x(), from.y(), -from.z());
+        btVector3 direction(to.x() - from.x(), to.y() - from.y(), from.z() - to.z());
+
+        // Clip the segment to the cells. Cell x spans [x, x + 1], the last voxel of every axis has no cell of its own.
+        const long long numCells[3] = {
+            static_cast<long long>(terrain.getWidth()) - 1,
+            static_cast<long long>(terrain.getHeight()) - 1,
+            static_cast<long long>(terrain.getDepth()) - 1
+        };
+
+        btScalar begin = 0;
+        btScalar end = 1;
+        for (int axis = 0; axis < 3; axis++) {
+            auto size = static_cast<btScalar>(numCells[axis]);
+            if (direction[axis] == 0) {
+                if (origin[axis] < 0 || origin[axis] > size) {
+                    return false;
+                }
+
+                continue;
+            }
+
+            auto t0 = -origin[axis] / direction[axis];
+            auto t1 = (size - origin[axis]) / direction[axis];
+            begin = std::max(begin, std::min(t0, t1));
+            end = std::min(end, std::max(t0, t1));
+        }
+
+        if (begin > end) {
+            return false;
+        }
+
+        // Walk the cells in the order the segment crosses them. Triangles never leave their cell,
+        // so the first cell with a hit has the closest one.
+        auto start = origin + direction * begin;
+        long long cell[3];
+        long long step[3];
+        btScalar next[3];
+        btScalar delta[3];
+        for (int axis = 0; axis < 3; axis++) {
+            cell[axis] = std::min(std::max(static_cast<long long>(std::floor(start[axis])), 0LL), numCells[axis] - 1);
+            if (direction[axis] > 0) {
+                step[axis] = 1;
+                next[axis] = (cell[axis] + 1 - origin[axis]) / direction[axis];
+                delta[axis] = 1 / direction[axis];
+            }
+            else if (direction[axis] < 0) {
+                step[axis] = -1;
+                next[axis] = (cell[axis] - origin[axis]) / direction[axis];
+                delta[axis] = -1 / direction[axis];
+            }
+            else {
+                step[axis] = 0;
+                next[axis] = BT_LARGE_FLOAT;
+                delta[axis] = BT_LARGE_FLOAT;
+            }
+        }
+
+        while (true) {
+            if (intersectCell(static_cast<size_t>(cell[0]), static_cast<size_t>(cell[1]), static_cast<size_t>(cell[2]),
+                              from, to, outFraction, outNormal)) {
+                return true;
+            }
+
+            auto axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+            if (next[axis] > end) {
+                return false;
+            }
+
+            cell[axis] += step[axis];
+            if (cell[axis] < 0 || cell[axis] >= numCells[axis]) {
+                return false;
+            }
+
+            next[axis] += delta[axis];
+        }
+    }
+
+    bool VoxelRaycaster::intersectCell(size_t x, size_t y, size_t z, const btVector3& from, const btVector3& to,
+                                       btScalar& outFraction, btVector3& outNormal) {
+        GridCell gridCell;
+        for (int i = 0; i < 8; i++) {
+            auto cornerX = x + CellCorners[i][0];
+            auto cornerY = y + CellCorners[i][1];
+            auto cornerZ = z + CellCorners[i][2];
+            gridCell.positions[i] = glm::vec3(cornerX, cornerY, cornerZ);
+            gridCell.values[i] = static_cast<uint8_t>(terrain.getVoxel(cornerX, cornerY, cornerZ));
+        }
+
+        positions.clear();
+        indices.clear();
+        polygonize(gridCell, positions, indices);
+
+        // Both sides of the triangles count, like with Bullet's triangle ray tests
+        auto direction = to - from;
+        auto closest = BT_LARGE_FLOAT;
+        btVector3 normal;
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            const auto& a = positions[indices[i]];
+            const auto& b = positions[indices[i + 1]];
+            const auto& c = positions[indices[i + 2]];
+            btVector3 vertex(a.x, a.y, a.z);
+            btVector3 edge1(b.x - a.x, b.y - a.y, b.z - a.z);
+            btVector3 edge2(c.x - a.x, c.y - a.y, c.z - a.z);
+
+            auto p = direction.cross(edge2);
+            auto determinant = edge1.dot(p);
+            if (std::abs(determinant) < SIMD_EPSILON) {
+                continue;
+            }
+
+            auto inverseDeterminant = 1 / determinant;
+            auto offset = from - vertex;
+            auto u = offset.dot(p) * inverseDeterminant;
+            if (u < 0 || u > 1) {
+                continue;
+            }
+
+            auto q = offset.cross(edge1);
+            auto v = direction.dot(q) * inverseDeterminant;
+            if (v < 0 || u + v > 1) {
+                continue;
+            }
+
+            // Like Bullet, a segment starting on a triangle doesn't hit it
+            auto t = edge2.dot(q) * inverseDeterminant;
+            if (t > 0 && t <= 1 && t < closest) {
+                closest = t;
+                normal = edge1.cross(edge2);
+            }
+        }
+
+        if (closest == BT_LARGE_FLOAT) {
+            return false;
+        }
+
+        normal.normalize();
+        outFraction = closest;
+        outNormal = normal.dot(direction) > 0 ? -normal : normal;
+        return true;
+    }
+}
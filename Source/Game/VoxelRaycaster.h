@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <btBulletCollisionCommon.h>
+#include <glm/glm.hpp>
+
+namespace tankwars {
+    class VoxelTerrain;
+
+    // Intersects segments with the terrain's marching cubes surface, without any collision shapes.
+    // The segment walks the cells it crosses and only polygonizes the ones the surface passes through,
+    // so a short segment costs a few cells no matter how big the map is.
+    class VoxelRaycaster {
+    public:
+        // The terrain must not move in memory while the raycaster is used
+        explicit VoxelRaycaster(const VoxelTerrain& terrain);
+
+        // Returns true if the segment hits the surface, with the hit as a fraction of the segment
+        // and the surface normal facing from
+        bool castRay(const btVector3& from, const btVector3& to, btScalar& outFraction, btVector3& outNormal);
+
+    private:
+        // Intersects the segment with the triangles of the cell whose lowest voxel is (x, y, z)
+        bool intersectCell(size_t x, size_t y, size_t z, const btVector3& from, const btVector3& to,
+                           btScalar& outFraction, btVector3& outNormal);
+
+        const VoxelTerrain& terrain;
+
+        // Scratch memory of the cells
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t> indices;
+    };
+}
@@ -0,0 +1,700 @@
+#include "VoxelStorage.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace tankwars {
+    namespace {
+        // The bits [begin, end) of a word, 0 <= begin < end <= 64
+        uint64_t makeBitMask(size_t begin, size_t end) {
+            auto endMask = end == 64 ? ~uint64_t(0) : (uint64_t(1) << end) - 1;
+            return endMask & ~((uint64_t(1) << begin) - 1);
+        }
+
+        bool isPowerOfTwo(size_t value) {
+            return value != 0 && (value & (value - 1)) == 0;
+        }
+
+        size_t countBits(size_t size) {
+            size_t numBits = 0;
+            while ((size_t(1) << numBits) < size) {
+                numBits++;
+            }
+
+            return numBits;
+        }
+
+        size_t clampToSize(float value, size_t size) {
+            if (value < 0.0f) {
+                return 0;
+            }
+
+            return std::min(size, static_cast<size_t>(value));
+        }
+    }
+
+    VoxelBox::VoxelBox()
+            : beginX(0), beginY(0), beginZ(0),
+              endX(SIZE_MAX), endY(SIZE_MAX), endZ(SIZE_MAX) {
+    }
+
+    VoxelBox::VoxelBox(size_t beginX, size_t beginY, size_t beginZ, size_t endX, size_t endY, size_t endZ)
+            : beginX(beginX), beginY(beginY), beginZ(beginZ),
+              endX(endX), endY(endY), endZ(endZ) {
+    }
+
+    VoxelStorage::VoxelStorage(size_t width, size_t height, size_t depth)
+            : width(width), height(height), depth(depth) {
+    }
+
+    bool VoxelStorage::clearSphere(const glm::vec3& center, float radius) {
+        auto beginX = clampToSize(std::floor(center.x - radius), width);
+        auto endX = clampToSize(std::floor(center.x + radius) + 1.0f, width);
+        auto beginZ = clampToSize(std::floor(center.z - radius), depth);
+        auto endZ = clampToSize(std::floor(center.z + radius) + 1.0f, depth);
+
+        // Every column inside the sphere is cleared as a single span
+        auto hasChanged = false;
+        for (auto z = beginZ; z < endZ; z++)
+        for (auto x = beginX; x < endX; x++) {
+            auto dx = x - center.x;
+            auto dz = z - center.z;
+            auto maxDySquared = radius * radius - dx * dx - dz * dz;
+            if (maxDySquared <= 0.0f) {
+                continue;
+            }
+
+            auto maxDy = std::sqrt(maxDySquared);
+            auto beginY = clampToSize(std::floor(center.y - maxDy), height);
+            auto endY = clampToSize(std::floor(center.y + maxDy) + 1.0f, height);
+
+            auto isInside = [&](size_t y) {
+                auto dy = y - center.y;
+                return dy * dy < maxDySquared;
+            };
+
+            while (beginY < endY && !isInside(beginY)) {
+                beginY++;
+            }
+
+            while (endY > beginY && !isInside(endY - 1)) {
+                endY--;
+            }
+
+            if (beginY < endY) {
+                hasChanged = fillColumn(x, z, beginY, endY, VoxelType::Empty) || hasChanged;
+            }
+        }
+
+        return hasChanged;
+    }
+
+    bool VoxelStorage::isRegionEmpty(size_t beginX, size_t beginY, size_t beginZ,
+                                     size_t endX, size_t endY, size_t endZ) const {
+        for (auto z = beginZ; z < endZ; z++)
+        for (auto x = beginX; x < endX; x++) {
+            if (!isColumnEmpty(x, z, beginY, endY)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    size_t VoxelStorage::getColumnTop(size_t x, size_t z, size_t endY) const {
+        for (auto y = endY; y > 0; y--) {
+            if (get(x, y - 1, z) == VoxelType::Solid) {
+                return y;
+            }
+        }
+
+        return 0;
+    }
+
+    bool VoxelStorage::isBlockUniform(size_t startX, size_t startY, size_t startZ,
+                                      size_t sizeX, size_t sizeY, size_t sizeZ) const {
+        auto value = get(startX, startY, startZ);
+        for (auto z = startZ; z < startZ + sizeZ; z++)
+        for (auto y = startY; y < startY + sizeY; y++)
+        for (auto x = startX; x < startX + sizeX; x++) {
+            if (get(x, y, z) != value) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    size_t VoxelStorage::getWidth() const {
+        return width;
+    }
+
+    size_t VoxelStorage::getHeight() const {
+        return height;
+    }
+
+    size_t VoxelStorage::getDepth() const {
+        return depth;
+    }
+
+    std::unique_ptr<VoxelStorage> VoxelStorage::create(VoxelStorageType type,
+            size_t width, size_t height, size_t depth,
+            size_t brickWidth, size_t brickHeight, size_t brickDepth) {
+        switch (type) {
+        case VoxelStorageType::Bit:
+            return std::unique_ptr<VoxelStorage>(new BitVoxelStorage(width, height, depth));
+        case VoxelStorageType::Columns:
+            return std::unique_ptr<VoxelStorage>(new ColumnVoxelStorage(width, height, depth));
+        case VoxelStorageType::Bricked:
+        case VoxelStorageType::BrickedMorton:
+            return std::unique_ptr<VoxelStorage>(new BrickedVoxelStorage(width, height, depth,
+                brickWidth, brickHeight, brickDepth, type == VoxelStorageType::BrickedMorton));
+        default:
+            return std::unique_ptr<VoxelStorage>(new ByteVoxelStorage(width, height, depth));
+        }
+    }
+
+    ByteVoxelStorage::ByteVoxelStorage(size_t width, size_t height, size_t depth)
+            : VoxelStorage(width, height, depth),
+              voxels(width * height * depth, static_cast<uint8_t>(VoxelType::Empty)) {
+    }
+
+    VoxelType ByteVoxelStorage::get(size_t x, size_t y, size_t z) const {
+        return static_cast<VoxelType>(voxels[x + y * width + z * width * height]);
+    }
+
+    void ByteVoxelStorage::set(size_t x, size_t y, size_t z, VoxelType voxel) {
+        voxels[x + y * width + z * width * height] = static_cast<uint8_t>(voxel);
+    }
+
+    bool ByteVoxelStorage::fillColumn(size_t x, size_t z, size_t beginY, size_t endY, VoxelType voxel) {
+        assert(beginY <= endY && endY <= height);
+
+        auto value = static_cast<uint8_t>(voxel);
+        auto hasChanged = false;
+        auto index = x + beginY * width + z * width * height;
+        for (auto y = beginY; y < endY; y++, index += width) {
+            hasChanged = hasChanged || voxels[index] != value;
+            voxels[index] = value;
+        }
+
+        return hasChanged;
+    }
+
+    bool ByteVoxelStorage::isColumnEmpty(size_t x, size_t z, size_t beginY, size_t endY) const {
+        auto index = x + beginY * width + z * width * height;
+        for (auto y = beginY; y < endY; y++, index += width) {
+            if (voxels[index] != static_cast<uint8_t>(VoxelType::Empty)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void ByteVoxelStorage::copyBlock(size_t startX, size_t startY, size_t startZ,
+                                     size_t sizeX, size_t sizeY, size_t sizeZ, uint8_t* out) const {
+        // Rows are contiguous in both arrays
+        for (auto z = startZ; z < startZ + sizeZ; z++)
+        for (auto y = startY; y < startY + sizeY; y++) {
+            std::memcpy(out, &voxels[startX + y * width + z * width * height], sizeX);
+            out += sizeX;
+        }
+    }
+
+    size_t ByteVoxelStorage::getMemoryUsage() const {
+        return voxels.size() * sizeof(uint8_t);
+    }
+
+    BitVoxelStorage::BitVoxelStorage(size_t width, size_t height, size_t depth)
+            : VoxelStorage(width, height, depth),
+              wordsPerColumn((height + 63) / 64),
+              words(width * depth * wordsPerColumn, 0) {
+    }
+
+    VoxelType BitVoxelStorage::get(size_t x, size_t y, size_t z) const {
+        auto word = getColumn(x, z)[y / 64];
+        return static_cast<VoxelType>((word >> (y % 64)) & 1);
+    }
+
+    void BitVoxelStorage::set(size_t x, size_t y, size_t z, VoxelType voxel) {
+        auto& word = getColumn(x, z)[y / 64];
+        auto bit = uint64_t(1) << (y % 64);
+        word = voxel == VoxelType::Solid ? word | bit : word & ~bit;
+    }
+
+    bool BitVoxelStorage::fillColumn(size_t x, size_t z, size_t beginY, size_t endY, VoxelType voxel) {
+        assert(beginY <= endY && endY <= height);
+
+        auto column = getColumn(x, z);
+        auto hasChanged = false;
+        for (auto y = beginY; y < endY; y = (y / 64 + 1) * 64) {
+            auto& word = column[y / 64];
+            auto mask = makeBitMask(y % 64, std::min(endY - y / 64 * 64, static_cast<size_t>(64)));
+            auto newWord = voxel == VoxelType::Solid ? word | mask : word & ~mask;
+            hasChanged = hasChanged || newWord != word;
+            word = newWord;
+        }
+
+        return hasChanged;
+    }
+
+    bool BitVoxelStorage::isColumnEmpty(size_t x, size_t z, size_t beginY, size_t endY) const {
+        auto column = getColumn(x, z);
+        for (auto y = beginY; y < endY; y = (y / 64 + 1) * 64) {
+            auto mask = makeBitMask(y % 64, std::min(endY - y / 64 * 64, static_cast<size_t>(64)));
+            if (column[y / 64] & mask) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void BitVoxelStorage::copyBlock(size_t startX, size_t startY, size_t startZ,
+                                    size_t sizeX, size_t sizeY, size_t sizeZ, uint8_t* out) const {
+        // Chunks are much lower than a word, so most blocks need one word per column.
+        // The words of a row of columns are gathered first, so the output is written in order.
+        if (startY % 64 + sizeY <= 64) {
+            uint64_t rowBits[64];
+            for (size_t z = 0; z < sizeZ; z++)
+            for (size_t firstX = 0; firstX < sizeX; firstX += 64) {
+                auto numColumns = std::min(sizeX - firstX, static_cast<size_t>(64));
+                for (size_t x = 0; x < numColumns; x++) {
+                    rowBits[x] = getColumn(startX + firstX + x, startZ + z)[startY / 64] >> (startY % 64);
+                }
+
+                auto dst = out + firstX + z * sizeX * sizeY;
+                for (size_t y = 0; y < sizeY; y++, dst += sizeX) {
+                    for (size_t x = 0; x < numColumns; x++) {
+                        dst[x] = static_cast<uint8_t>((rowBits[x] >> y) & 1);
+                    }
+                }
+            }
+
+            return;
+        }
+
+        for (size_t z = 0; z < sizeZ; z++)
+        for (size_t x = 0; x < sizeX; x++) {
+            auto column = getColumn(startX + x, startZ + z);
+            auto dst = out + x + z * sizeX * sizeY;
+            for (size_t y = 0; y < sizeY; y++, dst += sizeX) {
+                auto voxelY = startY + y;
+                *dst = static_cast<uint8_t>((column[voxelY / 64] >> (voxelY % 64)) & 1);
+            }
+        }
+    }
+
+    size_t BitVoxelStorage::getMemoryUsage() const {
+        return words.size() * sizeof(uint64_t);
+    }
+
+    const uint64_t* BitVoxelStorage::getColumn(size_t x, size_t z) const {
+        return &words[(x + z * width) * wordsPerColumn];
+    }
+
+    uint64_t* BitVoxelStorage::getColumn(size_t x, size_t z) {
+        return &words[(x + z * width) * wordsPerColumn];
+    }
+
+    BrickedVoxelStorage::BrickedVoxelStorage(size_t width, size_t height, size_t depth,
+            size_t brickWidth, size_t brickHeight, size_t brickDepth, bool useMortonOrder)
+            : VoxelStorage(width, height, depth),
+              brickHeight(brickHeight),
+              brickVolume(brickWidth * brickHeight * brickDepth),
+              bricksX(width), bricksY(height), bricksZ(depth),
+              localsX(width), localsY(height), localsZ(depth),
+              runLengthsX(width) {
+        auto numBricksX = (width + brickWidth - 1) / brickWidth;
+        auto numBricksY = (height + brickHeight - 1) / brickHeight;
+        auto numBricksZ = (depth + brickDepth - 1) / brickDepth;
+        auto numBricks = numBricksX * numBricksY * numBricksZ;
+        bricks.resize(numBricks);
+        uniformTypes.resize(numBricks, VoxelType::Empty);
+        numSolidVoxels.resize(numBricks, 0);
+
+        // Position of a voxel inside its brick, for each axis on its own
+        std::vector<size_t> localX(brickWidth), localY(brickHeight), localZ(brickDepth);
+        if (useMortonOrder && isPowerOfTwo(brickWidth) && isPowerOfTwo(brickHeight) && isPowerOfTwo(brickDepth)) {
+            // Interleave the bits of the axes, skipping an axis once it has run out of bits,
+            // so the order also covers bricks that aren't cubes without leaving gaps
+            std::vector<size_t>* locals[] = { &localX, &localY, &localZ };
+            size_t numBits[] = { countBits(brickWidth), countBits(brickHeight), countBits(brickDepth) };
+            size_t outBit = 0;
+            for (size_t bit = 0; bit < std::max(numBits[0], std::max(numBits[1], numBits[2])); bit++)
+            for (int axis = 0; axis < 3; axis++) {
+                if (bit >= numBits[axis]) {
+                    continue;
+                }
+
+                auto& local = *locals[axis];
+                for (size_t i = 0; i < local.size(); i++) {
+                    local[i] |= ((i >> bit) & 1) << outBit;
+                }
+
+                outBit++;
+            }
+        }
+        else {
+            for (size_t i = 0; i < brickWidth; i++) {
+                localX[i] = i;
+            }
+
+            for (size_t i = 0; i < brickHeight; i++) {
+                localY[i] = i * brickWidth;
+            }
+
+            for (size_t i = 0; i < brickDepth; i++) {
+                localZ[i] = i * brickWidth * brickHeight;
+            }
+        }
+
+        for (size_t x = 0; x < width; x++) {
+            bricksX[x] = x / brickWidth;
+            localsX[x] = localX[x % brickWidth];
+        }
+
+        for (size_t y = 0; y < height; y++) {
+            bricksY[y] = (y / brickHeight) * numBricksX;
+            localsY[y] = localY[y % brickHeight];
+        }
+
+        for (size_t z = 0; z < depth; z++) {
+            bricksZ[z] = (z / brickDepth) * numBricksX * numBricksY;
+            localsZ[z] = localZ[z % brickDepth];
+        }
+
+        for (auto x = width; x-- > 0;) {
+            auto isContiguous = x + 1 < width && bricksX[x + 1] == bricksX[x] && localsX[x + 1] == localsX[x] + 1;
+            runLengthsX[x] = isContiguous ? runLengthsX[x + 1] + 1 : 1;
+        }
+    }
+
+    VoxelType BrickedVoxelStorage::get(size_t x, size_t y, size_t z) const {
+        auto& brick = bricks[getBrick(x, y, z)];
+        if (!brick) {
+            return uniformTypes[getBrick(x, y, z)];
+        }
+
+        return static_cast<VoxelType>(brick[getLocalIndex(x, y, z)]);
+    }
+
+    void BrickedVoxelStorage::set(size_t x, size_t y, size_t z, VoxelType voxel) {
+        auto brick = getBrick(x, y, z);
+        if (!bricks[brick] && uniformTypes[brick] == voxel) {
+            return;
+        }
+
+        auto& current = makeMixed(brick)[getLocalIndex(x, y, z)];
+        if (current != static_cast<uint8_t>(voxel)) {
+            numSolidVoxels[brick] += voxel == VoxelType::Solid ? 1 : -1;
+            current = static_cast<uint8_t>(voxel);
+            releaseIfUniform(brick);
+        }
+    }
+
+    bool BrickedVoxelStorage::fillColumn(size_t x, size_t z, size_t beginY, size_t endY, VoxelType voxel) {
+        assert(beginY <= endY && endY <= height);
+
+        // Fill the column brick by brick, bricks that already hold the value are skipped
+        auto value = static_cast<uint8_t>(voxel);
+        auto hasChanged = false;
+        for (auto y = beginY; y < endY;) {
+            auto brick = getBrick(x, y, z);
+            auto endOfBrick = std::min(endY, (y / brickHeight + 1) * brickHeight);
+            if (!bricks[brick] && uniformTypes[brick] == voxel) {
+                y = endOfBrick;
+                continue;
+            }
+
+            auto voxels = makeMixed(brick);
+            auto columnIndex = localsX[x] + localsZ[z];
+            for (; y < endOfBrick; y++) {
+                auto& current = voxels[columnIndex + localsY[y]];
+                if (current != value) {
+                    numSolidVoxels[brick] += voxel == VoxelType::Solid ? 1 : -1;
+                    current = value;
+                    hasChanged = true;
+                }
+            }
+
+            releaseIfUniform(brick);
+        }
+
+        return hasChanged;
+    }
+
+    bool BrickedVoxelStorage::isColumnEmpty(size_t x, size_t z, size_t beginY, size_t endY) const {
+        for (auto y = beginY; y < endY;) {
+            auto brick = getBrick(x, y, z);
+            auto endOfBrick = std::min(endY, (y / brickHeight + 1) * brickHeight);
+            if (!bricks[brick]) {
+                if (uniformTypes[brick] != VoxelType::Empty) {
+                    return false;
+                }
+
+                y = endOfBrick;
+                continue;
+            }
+
+            auto columnIndex = localsX[x] + localsZ[z];
+            for (; y < endOfBrick; y++) {
+                if (bricks[brick][columnIndex + localsY[y]] != static_cast<uint8_t>(VoxelType::Empty)) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    bool BrickedVoxelStorage::isBlockUniform(size_t startX, size_t startY, size_t startZ,
+                                             size_t sizeX, size_t sizeY, size_t sizeZ) const {
+        // Uniform bricks are decided by their tag, only mixed bricks have to be looked at
+        auto value = get(startX, startY, startZ);
+        for (auto z = startZ; z < startZ + sizeZ; z++)
+        for (auto y = startY; y < startY + sizeY; y++)
+        for (auto x = startX; x < startX + sizeX;) {
+            auto brick = getBrick(x, y, z);
+            auto runLength = std::min(runLengthsX[x], startX + sizeX - x);
+            if (!bricks[brick]) {
+                if (uniformTypes[brick] != value) {
+                    return false;
+                }
+
+                x += runLength;
+                continue;
+            }
+
+            for (; runLength > 0; runLength--, x++) {
+                if (bricks[brick][getLocalIndex(x, y, z)] != static_cast<uint8_t>(value)) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    void BrickedVoxelStorage::copyBlock(size_t startX, size_t startY, size_t startZ,
+                                        size_t sizeX, size_t sizeY, size_t sizeZ, uint8_t* out) const {
+        // Copy the parts of a row that are contiguous in a brick at once.
+        // Without Morton order that is a whole row of a brick.
+        for (auto z = startZ; z < startZ + sizeZ; z++)
+        for (auto y = startY; y < startY + sizeY; y++)
+        for (auto x = startX; x < startX + sizeX;) {
+            auto brick = getBrick(x, y, z);
+            auto runLength = std::min(runLengthsX[x], startX + sizeX - x);
+            if (bricks[brick]) {
+                std::memcpy(out, &bricks[brick][getLocalIndex(x, y, z)], runLength);
+            }
+            else {
+                std::memset(out, static_cast<int>(uniformTypes[brick]), runLength);
+            }
+
+            out += runLength;
+            x += runLength;
+        }
+    }
+
+    size_t BrickedVoxelStorage::getMemoryUsage() const {
+        auto tagSize = sizeof(std::unique_ptr<uint8_t[]>) + sizeof(VoxelType) + sizeof(uint32_t);
+        return numMixedBricks * brickVolume + bricks.size() * tagSize;
+    }
+
+    uint8_t* BrickedVoxelStorage::makeMixed(size_t brick) {
+        if (!bricks[brick]) {
+            bricks[brick].reset(new uint8_t[brickVolume]);
+            std::memset(bricks[brick].get(), static_cast<int>(uniformTypes[brick]), brickVolume);
+            numMixedBricks++;
+        }
+
+        return bricks[brick].get();
+    }
+
+    void BrickedVoxelStorage::releaseIfUniform(size_t brick) {
+        if (numSolidVoxels[brick] == 0 || numSolidVoxels[brick] == brickVolume) {
+            uniformTypes[brick] = numSolidVoxels[brick] == 0 ? VoxelType::Empty : VoxelType::Solid;
+            bricks[brick].reset();
+            numMixedBricks--;
+        }
+    }
+
+    constexpr ColumnVoxelStorage::Run ColumnVoxelStorage::SplitColumn;
+
+    ColumnVoxelStorage::ColumnVoxelStorage(size_t width, size_t height, size_t depth)
+            : VoxelStorage(width, height, depth),
+              inlineRuns(width * depth, Run{ 0, 0 }) {
+        assert(height <= 0xffff);
+    }
+
+    VoxelType ColumnVoxelStorage::get(size_t x, size_t y, size_t z) const {
+        size_t numRuns;
+        auto runs = getRuns(x + z * width, numRuns);
+        for (size_t i = 0; i < numRuns && runs[i].begin <= y; i++) {
+            if (y < runs[i].end) {
+                return VoxelType::Solid;
+            }
+        }
+
+        return VoxelType::Empty;
+    }
+
+    void ColumnVoxelStorage::set(size_t x, size_t y, size_t z, VoxelType voxel) {
+        fillColumn(x, z, y, y + 1, voxel);
+    }
+
+    bool ColumnVoxelStorage::fillColumn(size_t x, size_t z, size_t beginY, size_t endY, VoxelType voxel) {
+        assert(beginY <= endY && endY <= height);
+        if (beginY == endY) {
+            return false;
+        }
+
+        auto column = x + z * width;
+        size_t numRuns;
+        auto runs = getRuns(column, numRuns);
+
+        newRuns.clear();
+        if (voxel == VoxelType::Solid) {
+            // Merge the new run with all runs it overlaps or touches
+            Run filled = { static_cast<uint16_t>(beginY), static_cast<uint16_t>(endY) };
+            size_t i = 0;
+            for (; i < numRuns && runs[i].end < filled.begin; i++) {
+                newRuns.push_back(runs[i]);
+            }
+
+            for (; i < numRuns && runs[i].begin <= filled.end; i++) {
+                filled.begin = std::min(filled.begin, runs[i].begin);
+                filled.end = std::max(filled.end, runs[i].end);
+            }
+
+            newRuns.push_back(filled);
+            newRuns.insert(newRuns.end(), runs + i, runs + numRuns);
+        }
+        else {
+            // Cut [beginY, endY) out of every run
+            for (size_t i = 0; i < numRuns; i++) {
+                if (runs[i].begin < beginY) {
+                    newRuns.push_back({ runs[i].begin, static_cast<uint16_t>(std::min<size_t>(runs[i].end, beginY)) });
+                }
+
+                if (runs[i].end > endY) {
+                    newRuns.push_back({ static_cast<uint16_t>(std::max<size_t>(runs[i].begin, endY)), runs[i].end });
+                }
+            }
+        }
+
+        auto isSame = newRuns.size() == numRuns && std::equal(newRuns.begin(), newRuns.end(), runs,
+            [](const Run& a, const Run& b) { return a.begin == b.begin && a.end == b.end; });
+        if (isSame) {
+            return false;
+        }
+
+        if (newRuns.size() <= 1) {
+            inlineRuns[column] = newRuns.empty() ? Run{ 0, 0 } : newRuns[0];
+            splitColumns.erase(column);
+        }
+        else {
+            inlineRuns[column] = SplitColumn;
+            splitColumns[column] = newRuns;
+        }
+
+        return true;
+    }
+
+    bool ColumnVoxelStorage::isColumnEmpty(size_t x, size_t z, size_t beginY, size_t endY) const {
+        size_t numRuns;
+        auto runs = getRuns(x + z * width, numRuns);
+        for (size_t i = 0; i < numRuns && runs[i].begin < endY; i++) {
+            if (runs[i].end > beginY) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    size_t ColumnVoxelStorage::getColumnTop(size_t x, size_t z, size_t endY) const {
+        size_t numRuns;
+        auto runs = getRuns(x + z * width, numRuns);
+        for (auto i = numRuns; i > 0; i--) {
+            if (runs[i - 1].begin < endY) {
+                return std::min<size_t>(runs[i - 1].end, endY);
+            }
+        }
+
+        return 0;
+    }
+
+    bool ColumnVoxelStorage::isBlockUniform(size_t startX, size_t startY, size_t startZ,
+                                            size_t sizeX, size_t sizeY, size_t sizeZ) const {
+        // Every column has to be either completely inside a run or outside of all runs
+        auto value = get(startX, startY, startZ);
+        auto endY = startY + sizeY;
+        for (auto z = startZ; z < startZ + sizeZ; z++)
+        for (auto x = startX; x < startX + sizeX; x++) {
+            size_t numRuns;
+            auto runs = getRuns(x + z * width, numRuns);
+            auto isFull = false;
+            auto isEmpty = true;
+            for (size_t i = 0; i < numRuns && runs[i].begin < endY; i++) {
+                if (runs[i].end > startY) {
+                    isEmpty = false;
+                    isFull = runs[i].begin <= startY && runs[i].end >= endY;
+                    break;
+                }
+            }
+
+            if (value == VoxelType::Solid ? !isFull : !isEmpty) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void ColumnVoxelStorage::copyBlock(size_t startX, size_t startY, size_t startZ,
+                                       size_t sizeX, size_t sizeY, size_t sizeZ, uint8_t* out) const {
+        std::memset(out, static_cast<int>(VoxelType::Empty), sizeX * sizeY * sizeZ);
+
+        auto endY = startY + sizeY;
+        for (size_t z = 0; z < sizeZ; z++)
+        for (size_t x = 0; x < sizeX; x++) {
+            size_t numRuns;
+            auto runs = getRuns(startX + x + (startZ + z) * width, numRuns);
+            auto column = out + x + z * sizeX * sizeY;
+            for (size_t i = 0; i < numRuns && runs[i].begin < endY; i++) {
+                auto begin = std::max<size_t>(runs[i].begin, startY);
+                auto end = std::min<size_t>(runs[i].end, endY);
+                for (auto y = begin; y < end; y++) {
+                    column[(y - startY) * sizeX] = static_cast<uint8_t>(VoxelType::Solid);
+                }
+            }
+        }
+    }
+
+    size_t ColumnVoxelStorage::getMemoryUsage() const {
+        auto memoryUsage = inlineRuns.size() * sizeof(Run);
+        for (const auto& splitColumn : splitColumns) {
+            memoryUsage += sizeof(splitColumn) + splitColumn.second.capacity() * sizeof(Run);
+        }
+
+        return memoryUsage;
+    }
+
+    const ColumnVoxelStorage::Run* ColumnVoxelStorage::getRuns(size_t column, size_t& numRuns) const {
+        const auto& run = inlineRuns[column];
+        if (run.begin > run.end) {
+            const auto& runs = splitColumns.find(column)->second;
+            numRuns = runs.size();
+            return runs.data();
+        }
+
+        numRuns = run.begin < run.end ? 1 : 0;
+        return &run;
+    }
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace tankwars {
+    enum class VoxelType : uint8_t {
+        Empty = 0,
+        Solid = 1
+    };
+
+    enum class VoxelStorageType {
+        Byte,           // One byte per voxel
+        Bit,            // One bit per voxel, packed into 64 bit words along y
+        Bricked,        // One byte per voxel, the voxels of a chunk are contiguous
+        BrickedMorton,  // Like Bricked, but in Morton order inside a chunk
+        Columns         // Every column is a list of solid runs
+    };
+
+    // The voxels [begin, end) on every axis. A default box contains every voxel.
+    struct VoxelBox {
+        VoxelBox();
+        VoxelBox(size_t beginX, size_t beginY, size_t beginZ, size_t endX, size_t endY, size_t endZ);
+
+        size_t beginX, beginY, beginZ;
+        size_t endX, endY, endZ;
+    };
+
+    // Holds the voxels of the terrain. The bulk operations work on vertical columns,
+    // which is the shape most edits of the terrain have.
+    class VoxelStorage {
+    public:
+        VoxelStorage(size_t width, size_t height, size_t depth);
+        virtual ~VoxelStorage() = default;
+
+        virtual VoxelType get(size_t x, size_t y, size_t z) const = 0;
+        virtual void set(size_t x, size_t y, size_t z, VoxelType voxel) = 0;
+
+        // Sets the voxels [beginY, endY) of the column at (x, z). Returns true if any voxel changed.
+        virtual bool fillColumn(size_t x, size_t z, size_t beginY, size_t endY, VoxelType voxel) = 0;
+
+        // Returns true if the voxels [beginY, endY) of the column at (x, z) are all empty
+        virtual bool isColumnEmpty(size_t x, size_t z, size_t beginY, size_t endY) const = 0;
+
+        // Returns one more than the highest solid voxel below endY in the column at (x, z),
+        // 0 if there is none
+        virtual size_t getColumnTop(size_t x, size_t z, size_t endY) const;
+
+        // Returns true if all voxels of the box are the same
+        virtual bool isBlockUniform(size_t startX, size_t startY, size_t startZ,
+                                    size_t sizeX, size_t sizeY, size_t sizeZ) const;
+
+        // Copies a box of voxels into an array of one byte per voxel, x running fastest
+        virtual void copyBlock(size_t startX, size_t startY, size_t startZ,
+                               size_t sizeX, size_t sizeY, size_t sizeZ, uint8_t* out) const = 0;
+
+        // Bytes used by the voxel data
+        virtual size_t getMemoryUsage() const = 0;
+
+        // Empties every voxel closer than radius to center. Returns true if any voxel changed.
+        // The game carves with VoxelTerrain::fillSpheres, only the storage benchmark still uses this.
+        bool clearSphere(const glm::vec3& center, float radius);
+
+        // Returns true if all voxels in [begin, end) are empty
+        bool isRegionEmpty(size_t beginX, size_t beginY, size_t beginZ,
+                           size_t endX, size_t endY, size_t endZ) const;
+
+        size_t getWidth() const;
+        size_t getHeight() const;
+        size_t getDepth() const;
+
+        // The brick size is only used by the bricked storage types
+        static std::unique_ptr<VoxelStorage> create(VoxelStorageType type,
+            size_t width, size_t height, size_t depth,
+            size_t brickWidth, size_t brickHeight, size_t brickDepth);
+
+    protected:
+        size_t width, height, depth;
+    };
+
+    class ByteVoxelStorage : public VoxelStorage {
+    public:
+        ByteVoxelStorage(size_t width, size_t height, size_t depth);
+
+        VoxelType get(size_t x, size_t y, size_t z) const override;
+        void set(size_t x, size_t y, size_t z, VoxelType voxel) override;
+        bool fillColumn(size_t x, size_t z, size_t beginY, size_t endY, VoxelType voxel) override;
+        bool isColumnEmpty(size_t x, size_t z, size_t beginY, size_t endY) const override;
+        void copyBlock(size_t startX, size_t startY, size_t startZ,
+                       size_t sizeX, size_t sizeY, size_t sizeZ, uint8_t* out) const override;
+        size_t getMemoryUsage() const override;
+
+    private:
+        // Indexed by x + y * width + z * width * height
+        std::vector<uint8_t> voxels;
+    };
+
+    class BitVoxelStorage : public VoxelStorage {
+    public:
+        BitVoxelStorage(size_t width, size_t height, size_t depth);
+
+        VoxelType get(size_t x, size_t y, size_t z) const override;
+        void set(size_t x, size_t y, size_t z, VoxelType voxel) override;
+        bool fillColumn(size_t x, size_t z, size_t beginY, size_t endY, VoxelType voxel) override;
+        bool isColumnEmpty(size_t x, size_t z, size_t beginY, size_t endY) const override;
+        void copyBlock(size_t startX, size_t startY, size_t startZ,
+                       size_t sizeX, size_t sizeY, size_t sizeZ, uint8_t* out) const override;
+        size_t getMemoryUsage() const override;
+
+    private:
+        const uint64_t* getColumn(size_t x, size_t z) const;
+        uint64_t* getColumn(size_t x, size_t z);
+
+        // Every column is stored in wordsPerColumn words, bit y % 64 of word y / 64 is voxel y
+        size_t wordsPerColumn;
+        std::vector<uint64_t> words;
+    };
+
+    // Stores the voxels in bricks of brickWidth * brickHeight * brickDepth. A brick whose voxels
+    // are all the same is only a tag, its memory is allocated once it becomes mixed and released
+    // again once it is uniform. Morton order is only used if all brick dimensions are powers of two.
+    class BrickedVoxelStorage : public VoxelStorage {
+    public:
+        BrickedVoxelStorage(size_t width, size_t height, size_t depth,
+            size_t brickWidth, size_t brickHeight, size_t brickDepth, bool useMortonOrder);
+
+        VoxelType get(size_t x, size_t y, size_t z) const override;
+        void set(size_t x, size_t y, size_t z, VoxelType voxel) override;
+        bool fillColumn(size_t x, size_t z, size_t beginY, size_t endY, VoxelType voxel) override;
+        bool isColumnEmpty(size_t x, size_t z, size_t beginY, size_t endY) const override;
+        bool isBlockUniform(size_t startX, size_t startY, size_t startZ,
+                            size_t sizeX, size_t sizeY, size_t sizeZ) const override;
+        void copyBlock(size_t startX, size_t startY, size_t startZ,
+                       size_t sizeX, size_t sizeY, size_t sizeZ, uint8_t* out) const override;
+        size_t getMemoryUsage() const override;
+
+    private:
+        size_t getBrick(size_t x, size_t y, size_t z) const {
+            return bricksX[x] + bricksY[y] + bricksZ[z];
+        }
+
+        size_t getLocalIndex(size_t x, size_t y, size_t z) const {
+            return localsX[x] + localsY[y] + localsZ[z];
+        }
+
+        // Makes sure the brick has memory, before a voxel different from its tag is written
+        uint8_t* makeMixed(size_t brick);
+        void releaseIfUniform(size_t brick);
+
+        size_t brickHeight;
+        size_t brickVolume;
+
+        // The brick of a voxel and its index inside the brick are the sums of the parts of its coordinates
+        std::vector<size_t> bricksX, bricksY, bricksZ;
+        std::vector<size_t> localsX, localsY, localsZ;
+
+        // Number of voxels from x on that follow each other inside a brick
+        std::vector<size_t> runLengthsX;
+
+        std::vector<std::unique_ptr<uint8_t[]>> bricks; // Null for uniform bricks
+        std::vector<VoxelType> uniformTypes;
+        std::vector<uint32_t> numSolidVoxels;
+        size_t numMixedBricks = 0; // For getMemoryUsage, without walking all bricks
+    };
+
+    // Stores every column as a sorted list of runs of solid voxels, so the memory scales with
+    // the surface instead of the volume. Most columns are a single run and are stored inline.
+    class ColumnVoxelStorage : public VoxelStorage {
+    public:
+        ColumnVoxelStorage(size_t width, size_t height, size_t depth);
+
+        VoxelType get(size_t x, size_t y, size_t z) const override;
+        void set(size_t x, size_t y, size_t z, VoxelType voxel) override;
+        bool fillColumn(size_t x, size_t z, size_t beginY, size_t endY, VoxelType voxel) override;
+        bool isColumnEmpty(size_t x, size_t z, size_t beginY, size_t endY) const override;
+        size_t getColumnTop(size_t x, size_t z, size_t endY) const override;
+        bool isBlockUniform(size_t startX, size_t startY, size_t startZ,
+                            size_t sizeX, size_t sizeY, size_t sizeZ) const override;
+        void copyBlock(size_t startX, size_t startY, size_t startZ,
+                       size_t sizeX, size_t sizeY, size_t sizeZ, uint8_t* out) const override;
+        size_t getMemoryUsage() const override;
+
+    private:
+        // The solid voxels [begin, end)
+        struct Run {
+            uint16_t begin;
+            uint16_t end;
+        };
+
+        // A column with more than one run has this as its inline run
+        static constexpr Run SplitColumn = { 1, 0 };
+
+        // Returns the runs of the column at the given index
+        const Run* getRuns(size_t column, size_t& numRuns) const;
+
+        std::vector<Run> inlineRuns;
+        std::unordered_map<size_t, std::vector<Run>> splitColumns;
+        std::vector<Run> newRuns;
+    };
+}
@@ -1,53 +1,85 @@
 #include "VoxelTerrain.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 
 #include "Image.h"
 #include "GLTools.h"
-#include "MarchingCubes.h"
+#include "Camera.h"
 
 namespace tankwars {
+    using RemeshClock = std::chrono::high_resolution_clock;
+
+    // Chunks within this distance of a dynamic body, or of where it will be
+    // CollisionLookahead seconds later, are remeshed before all others
+    constexpr float CollisionMargin = 2.0f;
+    constexpr float CollisionLookahead = 0.25f;
+
+    // With lazy collision, a chunk keeps its collision mesh for this many remesh frames after
+    // the last dynamic body left it, so bodies moving along a chunk border don't rebuild it over and over
+    constexpr size_t CollisionEvictionFrames = 120;
+
+    // Number of chunks whose triangles the voxel collision shape keeps
+    constexpr size_t VoxelShapeCacheSize = 64;
+
     VoxelTerrain::VoxelTerrain(btDiscreteDynamicsWorld* dynamicsWorld,
         size_t numChunksX, size_t numChunksY, size_t numChunksZ,
-        size_t chunkWidth, size_t chunkHeight, size_t chunkDepth)
+        size_t chunkWidth, size_t chunkHeight, size_t chunkDepth, VoxelStorageType storageType)
             : numChunksX(numChunksX),
               numChunksY(numChunksY),
               numChunksZ(numChunksZ),
               chunkWidth(chunkWidth),
               chunkHeight(chunkHeight),
               chunkDepth(chunkDepth),
+              voxels(VoxelStorage::create(storageType, numChunksX * chunkWidth,
+                  numChunksY * chunkHeight, numChunksZ * chunkDepth, chunkWidth, chunkHeight, chunkDepth)),
+              workerPool(new WorkerPool),
               dynamicsWorld(dynamicsWorld) {
         auto numChunks = numChunksX * numChunksY * numChunksZ;
-        auto numVoxels = numChunks * chunkWidth * chunkHeight * chunkDepth;
-        voxels.resize(numVoxels, static_cast<uint8_t>(VoxelType::Empty));
 
-        chunkVertexArrays.resize(numChunks);
-        chunkVertexArrayBuffers.resize(numChunks);
-        chunkElementBuffers.resize(numChunks);
+        // GL objects are only created for chunks with geometry
+        chunkVertexArrays.resize(numChunks, 0);
+        chunkVertexArrayBuffers.resize(numChunks, 0);
+        chunkElementBuffers.resize(numChunks, 0);
         chunkElementCounts.resize(numChunks, 0);
         chunkDirtyStates.resize(numChunks, 1);
-
-        glGenVertexArrays(static_cast<GLsizei>(numChunks), chunkVertexArrays.data());
-        glGenBuffers(static_cast<GLsizei>(numChunks), chunkVertexArrayBuffers.data());
-        glGenBuffers(static_cast<GLsizei>(numChunks), chunkElementBuffers.data());
-
+        dirtyChunks.resize(numChunks);
         for (size_t i = 0; i < numChunks; i++) {
-            glBindVertexArray(chunkVertexArrays[i]);
-            glBindBuffer(GL_ARRAY_BUFFER, chunkVertexArrayBuffers[i]);
-            glEnableVertexAttribArray(0);
-            glEnableVertexAttribArray(1);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
-            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), bufferOffset(sizeof(glm::vec3)));
-            glBindVertexArray(0);
+            dirtyChunks[i] = i;
         }
+        chunkDirtyFrames.resize(numChunks, 0);
+        chunkRemeshStates.resize(numChunks, 0);
+        chunkCriticalFrames.resize(numChunks, 0);
 
-        chunkTriangleMeshes.resize(numChunks);
+        chunkVertices.resize(numChunks);
+        chunkIndices.resize(numChunks);
         chunkCollisionMeshes.resize(numChunks);
-        chunkMotionStates.resize(numChunks);
         chunkRigidBodies.resize(numChunks);
+        chunkCollisionListed.resize(numChunks, 0);
+
+        // Every column is looked at by the first remesh
+        auto numColumns = numChunksX * numChunksZ;
+        columnCriticalFrames.resize(numColumns, 0);
+        columnCollisionStates.resize(numColumns, ColumnCollisionState::Unknown);
+        columnDirtyStates.resize(numColumns, 1);
+        dirtyColumns.resize(numColumns);
+        for (size_t i = 0; i < numColumns; i++) {
+            dirtyColumns[i] = i;
+        }
+        columnHeights.resize(numColumns);
+        columnHeightfieldShapes.resize(numColumns);
+        columnHeightfieldBodies.resize(numColumns);
+        columnHeightfieldListed.resize(numColumns, 0);
     }
 
     VoxelTerrain::~VoxelTerrain() {
+        for (auto& job : pendingJobs) {
+            waitForJob(*job);
+        }
+
         glDeleteVertexArrays(static_cast<GLsizei>(chunkVertexArrays.size()), chunkVertexArrays.data());
         glDeleteBuffers(static_cast<GLsizei>(chunkVertexArrayBuffers.size()), chunkVertexArrayBuffers.data());
         glDeleteBuffers(static_cast<GLsizei>(chunkElementBuffers.size()), chunkElementBuffers.data());
@@ -57,6 +89,16 @@ namespace tankwars {
                 dynamicsWorld->removeRigidBody(body.get());
             }
         }
+
+        for (auto& body : columnHeightfieldBodies) {
+            if (body) {
+                dynamicsWorld->removeRigidBody(body.get());
+            }
+        }
+
+        if (voxelShapeBody) {
+            dynamicsWorld->removeRigidBody(voxelShapeBody.get());
+        }
     }
 
     void VoxelTerrain::setVoxel(size_t x, size_t y, size_t z, VoxelType voxel) {
@@ -64,21 +106,20 @@ namespace tankwars {
         assert(y < chunkHeight * numChunksY);
         assert(z < chunkDepth * numChunksZ);
 
-        auto index = x + y * getWidth() + z * getWidth() * getHeight();
-        if (static_cast<VoxelType>(voxels[index]) != voxel) {
-            voxels[index] = static_cast<uint8_t>(voxel);
-            chunkDirtyStates[computeChunkIndex(x, y, z)] = 1;
+        if (voxels->get(x, y, z) != voxel) {
+            voxels->set(x, y, z, voxel);
+            markChunkEdited(computeChunkIndex(x, y, z));
             
             if (x != 0 && x % chunkWidth == 0) {
-                chunkDirtyStates[computeChunkIndex(x - 1, y, z)] = 1;
+                markChunkEdited(computeChunkIndex(x - 1, y, z));
             }
 
             if (y != 0 && y % chunkHeight == 0) {
-                chunkDirtyStates[computeChunkIndex(x, y - 1, z)] = 1;
+                markChunkEdited(computeChunkIndex(x, y - 1, z));
             }
 
             if (z != 0 && z % chunkDepth == 0) {
-                chunkDirtyStates[computeChunkIndex(x, y, z - 1)] = 1;
+                markChunkEdited(computeChunkIndex(x, y, z - 1));
             }
         }
     }
@@ -88,8 +129,7 @@ namespace tankwars {
         assert(y < chunkHeight * numChunksY);
         assert(z < chunkDepth * numChunksZ);
 
-        auto index = x + y * getWidth() + z * getWidth() * getHeight();
-        return static_cast<VoxelType>(voxels[index]);
+        return voxels->get(x, y, z);
     }
 
     size_t VoxelTerrain::getWidth() const {
@@ -104,6 +144,121 @@ namespace tankwars {
         return chunkDepth * numChunksZ;
     }
 
+    void VoxelTerrain::fillColumn(size_t x, size_t z, size_t beginY, size_t endY, VoxelType voxel) {
+        assert(x < getWidth() && z < getDepth());
+        assert(beginY <= endY && endY <= getHeight());
+
+        if (voxels->fillColumn(x, z, beginY, endY, voxel)) {
+            markRegionDirty(VoxelBox(x, beginY, z, x + 1, endY, z + 1));
+        }
+    }
+
+    void VoxelTerrain::fillBox(const VoxelBox& box, VoxelType voxel) {
+        VoxelBox changed(SIZE_MAX, SIZE_MAX, SIZE_MAX, 0, 0, 0);
+        for (auto z = box.beginZ; z < std::min(box.endZ, getDepth()); z++)
+        for (auto x = box.beginX; x < std::min(box.endX, getWidth()); x++) {
+            fillSpan(x, z, box.beginY, std::min(box.endY, getHeight()), voxel, box, changed);
+        }
+
+        markRegionDirty(changed);
+    }
+
+    void VoxelTerrain::fillSphere(const glm::vec3& center, float radius, VoxelType voxel, const VoxelBox& bounds) {
+        auto centerX = static_cast<long long>(std::floor(center.x + 0.5f));
+        auto centerY = static_cast<long long>(std::floor(center.y + 0.5f));
+        auto centerZ = static_cast<long long>(std::floor(center.z + 0.5f));
+
+        VoxelBox changed(SIZE_MAX, SIZE_MAX, SIZE_MAX, 0, 0, 0);
+        for (const auto& span : getSphereStencil(radius)) {
+            fillSpan(centerX + span.dx, centerZ + span.dz, centerY - span.dy, centerY + span.dy + 1,
+                     voxel, bounds, changed);
+        }
+
+        markRegionDirty(changed);
+    }
+
+    void VoxelTerrain::fillSpheres(const std::vector<glm::vec3>& centers, float radius, VoxelType voxel,
+                                   const VoxelBox& bounds) {
+        const auto& stencil = getSphereStencil(radius);
+
+        mergedSpans.clear();
+        for (const auto& center : centers) {
+            auto centerX = static_cast<long long>(std::floor(center.x + 0.5f));
+            auto centerY = static_cast<long long>(std::floor(center.y + 0.5f));
+            auto centerZ = static_cast<long long>(std::floor(center.z + 0.5f));
+
+            for (const auto& span : stencil) {
+                mergedSpans.push_back({ centerX + span.dx, centerZ + span.dz, centerY - span.dy, centerY + span.dy + 1 });
+            }
+        }
+
+        // Sort the spans by column and merge the ones that overlap or touch
+        std::sort(mergedSpans.begin(), mergedSpans.end(), [](const ColumnSpan& a, const ColumnSpan& b) {
+            if (a.z != b.z) {
+                return a.z < b.z;
+            }
+
+            if (a.x != b.x) {
+                return a.x < b.x;
+            }
+
+            return a.beginY < b.beginY;
+        });
+
+        size_t numMerged = 0;
+        for (const auto& span : mergedSpans) {
+            if (numMerged > 0) {
+                auto& last = mergedSpans[numMerged - 1];
+                if (last.x == span.x && last.z == span.z && span.beginY <= last.endY) {
+                    last.endY = std::max(last.endY, span.endY);
+                    continue;
+                }
+            }
+
+            mergedSpans[numMerged++] = span;
+        }
+
+        // The spheres may be far apart, so the chunks are marked dirty per column instead of
+        // for the box around all spheres
+        for (size_t i = 0; i < numMerged; i++) {
+            const auto& span = mergedSpans[i];
+            VoxelBox changed(SIZE_MAX, SIZE_MAX, SIZE_MAX, 0, 0, 0);
+            fillSpan(span.x, span.z, span.beginY, span.endY, voxel, bounds, changed);
+            markRegionDirty(changed);
+        }
+    }
+
+    void VoxelTerrain::fillCylinder(const glm::vec3& baseCenter, float radius, float height, VoxelType voxel,
+                                    const VoxelBox& bounds) {
+        auto beginY = static_cast<long long>(std::floor(baseCenter.y + 0.5f));
+        auto endY = static_cast<long long>(std::floor(baseCenter.y + height + 0.5f));
+        auto beginX = static_cast<long long>(std::floor(baseCenter.x - radius));
+        auto endX = static_cast<long long>(std::floor(baseCenter.x + radius)) + 1;
+        auto beginZ = static_cast<long long>(std::floor(baseCenter.z - radius));
+        auto endZ = static_cast<long long>(std::floor(baseCenter.z + radius)) + 1;
+
+        VoxelBox changed(SIZE_MAX, SIZE_MAX, SIZE_MAX, 0, 0, 0);
+        for (auto z = beginZ; z < endZ; z++)
+        for (auto x = beginX; x < endX; x++) {
+            auto dx = x - baseCenter.x;
+            auto dz = z - baseCenter.z;
+            if (dx * dx + dz * dz < radius * radius) {
+                fillSpan(x, z, beginY, endY, voxel, bounds, changed);
+            }
+        }
+
+        markRegionDirty(changed);
+    }
+
+    size_t VoxelTerrain::getColumnTop(size_t x, size_t z, size_t endY) const {
+        assert(x < getWidth() && z < getDepth() && endY <= getHeight());
+        return voxels->getColumnTop(x, z, endY);
+    }
+
+    size_t VoxelTerrain::getVoxelMemoryUsage() const {
+        return voxels->getMemoryUsage();
+    }
+
     void VoxelTerrain::render() const {
         auto numChunks = numChunksX * numChunksY * numChunksZ;
         for (size_t i = 0; i < numChunks; i++) {
@@ -118,19 +273,571 @@ namespace tankwars {
     }
 
     void VoxelTerrain::updateMesh() {
-        for (size_t z = 0; z < numChunksZ; z++)
-        for (size_t y = 0; y < numChunksY; y++)
-        for (size_t x = 0; x < numChunksX; x++) {
-            auto chunkIndex = x + y * numChunksX + z * numChunksX * numChunksY;
-            if (chunkDirtyStates[chunkIndex]) {
-                updateChunk(x, y, z);
-                chunkDirtyStates[chunkIndex] = 0;
+        auto startTime = RemeshClock::now();
+        remeshFrame++;
+        numChunksRemeshed = 0;
+        markCollisionCriticalChunks();
+        updateHeightfields();
+        if (collisionType == TerrainCollisionType::LazyChunkMeshes) {
+            updateLazyCollision();
+        }
+
+        // Collect the dirty chunks that aren't being remeshed right now. The others stay
+        // dirty and get a new job once their current one has been swapped in.
+        remeshCandidates.clear();
+        size_t numStillDirty = 0;
+        size_t numCritical = 0;
+        for (auto i : dirtyChunks) {
+            if (chunkRemeshStates[i]) {
+                dirtyChunks[numStillDirty++] = i;
+                continue;
             }
+
+            RemeshCandidate candidate = { i, -1 };
+            if (chunkCriticalFrames[i] == remeshFrame) {
+                numCritical++;
+            }
+            else if (!cameras.empty()) {
+                auto cx = i % numChunksX;
+                auto cy = (i / numChunksX) % numChunksY;
+                auto cz = i / (numChunksX * numChunksY);
+                glm::vec3 center((cx + 0.5f) * chunkWidth, (cy + 0.5f) * chunkHeight, -(cz + 0.5f) * chunkDepth);
+
+                candidate.priority = std::numeric_limits<float>::max();
+                for (auto camera : cameras) {
+                    auto offset = camera->position - center;
+                    candidate.priority = std::min(candidate.priority, glm::dot(offset, offset));
+                }
+            }
+            else {
+                candidate.priority = 0;
+            }
+
+            remeshCandidates.push_back(candidate);
+        }
+
+        // Only as many chunks as fit into the budget are started, but at least one and all critical ones
+        auto numToStart = remeshCandidates.size();
+        if (remeshBudget > 0) {
+            auto numInBudget = std::max(static_cast<size_t>(remeshBudget / remeshCostEstimate), size_t(1));
+            numToStart = std::min(numToStart, std::max(numInBudget, numCritical));
+        }
+
+        auto byPriority = [](const RemeshCandidate& a, const RemeshCandidate& b) {
+            return a.priority < b.priority;
+        };
+        auto lastToStart = remeshCandidates.begin() + numToStart;
+        if (numToStart < remeshCandidates.size()) {
+            std::nth_element(remeshCandidates.begin(), lastToStart, remeshCandidates.end(), byPriority);
+        }
+        std::sort(remeshCandidates.begin(), lastToStart, byPriority);
+
+        // Start a job for every chosen chunk, the others are left dirty
+        auto firstNewJob = pendingJobs.size();
+        for (auto candidate = remeshCandidates.begin(); candidate != lastToStart; ++candidate) {
+            auto i = candidate->chunkIndex;
+            std::unique_ptr<RemeshJob> job;
+            if (freeJobs.empty()) {
+                job.reset(new RemeshJob);
+            }
+            else {
+                job = std::move(freeJobs.back());
+                freeJobs.pop_back();
+            }
+
+            // Chunks without any surface in their cells aren't remeshed at all. Asynchronously, they
+            // are released with the rest of their group by an empty job that is already finished.
+            chunkDirtyStates[i] = 0;
+            numChunksRemeshed++;
+            auto hasSurface = captureChunk(i, job->build);
+            if (!hasSurface && !isAsyncRemeshEnabled) {
+                releaseChunk(i);
+                freeJobs.push_back(std::move(job));
+                continue;
+            }
+
+            if (!hasSurface) {
+                job->build.indices.clear();
+            }
+
+            job->frameStarted = remeshFrame;
+            job->isFinished = !hasSurface;
+            chunkRemeshStates[i] = 1;
+            pendingJobs.push_back(std::move(job));
+        }
+
+        for (auto candidate = lastToStart; candidate != remeshCandidates.end(); ++candidate) {
+            dirtyChunks[numStillDirty++] = candidate->chunkIndex;
+        }
+
+        dirtyChunks.resize(numStillDirty);
+
+        remeshBacklogAge = 0;
+        for (auto i : dirtyChunks) {
+            remeshBacklogAge = std::max(remeshBacklogAge, remeshFrame - chunkDirtyFrames[i]);
+        }
+
+        // Marching cubes, normals and the collision meshes are built on the workers.
+        // Only the GL uploads and the changes to the dynamics world are done here.
+        if (isAsyncRemeshEnabled) {
+            for (auto i = firstNewJob; i < pendingJobs.size(); i++) {
+                auto job = pendingJobs[i].get();
+                if (job->isFinished) {
+                    continue;
+                }
+
+                workerPool->enqueue([this, job]() {
+                    buildChunk(job->build);
+                    finishJob(*job);
+                });
+            }
+        }
+        else {
+            workerPool->parallelFor(pendingJobs.size() - firstNewJob, [this, firstNewJob](size_t i) {
+                auto& job = *pendingJobs[firstNewJob + i];
+                buildChunk(job.build);
+                finishJob(job);
+            });
+        }
+
+        // Jobs started in the same frame are swapped in together, so the chunks touched
+        // by one edit never show mismatched geometry along their borders
+        auto latency = isAsyncRemeshEnabled ? maxRemeshLatency : 0;
+        size_t numRemaining = 0;
+        for (size_t first = 0, last = 0; first < pendingJobs.size(); first = last) {
+            auto frameStarted = pendingJobs[first]->frameStarted;
+            auto isGroupFinished = true;
+            for (; last < pendingJobs.size() && pendingJobs[last]->frameStarted == frameStarted; last++) {
+                std::lock_guard<std::mutex> lock(pendingJobs[last]->mutex);
+                isGroupFinished = isGroupFinished && pendingJobs[last]->isFinished;
+            }
+
+            if (!isGroupFinished && remeshFrame - frameStarted < latency) {
+                for (auto i = first; i < last; i++, numRemaining++) {
+                    if (i != numRemaining) {
+                        pendingJobs[numRemaining] = std::move(pendingJobs[i]);
+                    }
+                }
+
+                continue;
+            }
+
+            for (auto i = first; i < last; i++) {
+                auto& job = pendingJobs[i];
+                waitForJob(*job);
+                commitChunk(job->build);
+                chunkRemeshStates[job->build.chunkIndex] = 0;
+                freeJobs.push_back(std::move(job));
+            }
+        }
+
+        pendingJobs.resize(numRemaining);
+
+        if (numChunksRemeshed > 0) {
+            auto elapsed = std::chrono::duration<float, std::milli>(RemeshClock::now() - startTime).count();
+            remeshCostEstimate = 0.8f * remeshCostEstimate + 0.2f * std::max(elapsed / numChunksRemeshed, 0.001f);
+        }
+    }
+
+    void VoxelTerrain::markCollisionCriticalChunks() {
+        criticalChunks.clear();
+        criticalColumns.clear();
+        auto& objects = dynamicsWorld->getCollisionObjectArray();
+        for (int i = 0; i < objects.size(); i++) {
+            // Parked bodies, like the pooled bullets, don't collide
+            auto object = objects[i];
+            if (object->isStaticOrKinematicObject() || object->getActivationState() == DISABLE_SIMULATION) {
+                continue;
+            }
+
+            btVector3 aabbMin, aabbMax;
+            object->getCollisionShape()->getAabb(object->getWorldTransform(), aabbMin, aabbMax);
+            if (auto body = btRigidBody::upcast(object)) {
+                auto movement = body->getLinearVelocity() * CollisionLookahead;
+                aabbMin.setMin(aabbMin + movement);
+                aabbMax.setMax(aabbMax + movement);
+            }
+
+            btVector3 margin(CollisionMargin, CollisionMargin, CollisionMargin);
+            aabbMin -= margin;
+            aabbMax += margin;
+            auto toChunk = [](btScalar coordinate, size_t chunkSize, size_t numChunks) {
+                auto chunk = std::floor(coordinate / chunkSize);
+                return static_cast<size_t>(std::min(std::max(chunk, btScalar(0)), btScalar(numChunks - 1)));
+            };
+
+            // The terrain's z axis points the other way
+            auto beginX = toChunk(aabbMin.x(), chunkWidth, numChunksX);
+            auto beginY = toChunk(aabbMin.y(), chunkHeight, numChunksY);
+            auto beginZ = toChunk(-aabbMax.z(), chunkDepth, numChunksZ);
+            auto endX = toChunk(aabbMax.x(), chunkWidth, numChunksX);
+            auto endY = toChunk(aabbMax.y(), chunkHeight, numChunksY);
+            auto endZ = toChunk(-aabbMin.z(), chunkDepth, numChunksZ);
+            for (auto z = beginZ; z <= endZ; z++)
+            for (auto y = beginY; y <= endY; y++)
+            for (auto x = beginX; x <= endX; x++) {
+                auto chunkIndex = x + y * numChunksX + z * numChunksX * numChunksY;
+                if (chunkCriticalFrames[chunkIndex] != remeshFrame) {
+                    chunkCriticalFrames[chunkIndex] = remeshFrame;
+                    criticalChunks.push_back(chunkIndex);
+                }
+
+                auto column = x + z * numChunksX;
+                if (columnCriticalFrames[column] != remeshFrame) {
+                    columnCriticalFrames[column] = remeshFrame;
+                    criticalColumns.push_back(column);
+                }
+            }
+        }
+    }
+
+    void VoxelTerrain::updateLazyCollision() {
+        // Remeshing a chunk builds its collision mesh, dirty chunks get one anyway
+        for (auto i : criticalChunks) {
+            if (!chunkCollisionMeshes[i] && chunkElementCounts[i] > 0 && !chunkRemeshStates[i] &&
+                columnCollisionStates[getChunkColumn(i)] != ColumnCollisionState::Heightfield) {
+                markChunkDirty(i);
+            }
+        }
+
+        size_t numListed = 0;
+        for (auto i : collisionChunks) {
+            if (chunkRigidBodies[i] && remeshFrame - chunkCriticalFrames[i] > CollisionEvictionFrames) {
+                releaseChunkCollision(i);
+            }
+
+            // Chunks that lost their rigid body some other way are dropped from the list as well
+            if (chunkRigidBodies[i]) {
+                collisionChunks[numListed++] = i;
+            }
+            else {
+                chunkCollisionListed[i] = 0;
+            }
+        }
+
+        collisionChunks.resize(numListed);
+
+        numListed = 0;
+        for (auto column : heightfieldColumns) {
+            if (columnHeightfieldBodies[column] && remeshFrame - columnCriticalFrames[column] > CollisionEvictionFrames) {
+                releaseHeightfield(column);
+            }
+
+            if (columnHeightfieldBodies[column]) {
+                heightfieldColumns[numListed++] = column;
+            }
+            else {
+                columnHeightfieldListed[column] = 0;
+            }
+        }
+
+        heightfieldColumns.resize(numListed);
+    }
+
+    size_t VoxelTerrain::getChunkColumn(size_t chunkIndex) const {
+        return chunkIndex % numChunksX + chunkIndex / (numChunksX * numChunksY) * numChunksX;
+    }
+
+    void VoxelTerrain::markColumnDirty(size_t column) {
+        if (!columnDirtyStates[column]) {
+            columnDirtyStates[column] = 1;
+            dirtyColumns.push_back(column);
         }
     }
 
+    void VoxelTerrain::updateHeightfields() {
+        auto usesHeightfields = isHeightfieldCollisionEnabled && collisionType != TerrainCollisionType::VoxelShape;
+        auto isLazy = collisionType == TerrainCollisionType::LazyChunkMeshes;
+
+        // Lazily, columns near dynamic bodies get back their heightfield or are looked at for the first time
+        if (usesHeightfields && isLazy) {
+            for (auto column : criticalColumns) {
+                auto state = columnCollisionStates[column];
+                if (state == ColumnCollisionState::Unknown ||
+                    (state == ColumnCollisionState::Heightfield && !columnHeightfieldBodies[column])) {
+                    markColumnDirty(column);
+                }
+            }
+        }
+
+        for (auto column : dirtyColumns) {
+            columnDirtyStates[column] = 0;
+            if (usesHeightfields && isLazy && columnCriticalFrames[column] != remeshFrame && !hasColumnCollision(column)) {
+                columnCollisionStates[column] = ColumnCollisionState::Unknown;
+                continue;
+            }
+
+            auto chunkX = column % numChunksX;
+            auto chunkZ = column / numChunksX;
+            auto oldState = columnCollisionStates[column];
+            if (!usesHeightfields || !computeColumnHeights(column, columnHeights[column])) {
+                columnCollisionStates[column] = ColumnCollisionState::ChunkMeshes;
+                releaseHeightfield(column);
+
+                // The next remeshes build the chunk meshes, lazily only the ones near dynamic bodies
+                if (oldState != ColumnCollisionState::ChunkMeshes && collisionType == TerrainCollisionType::ChunkMeshes) {
+                    for (size_t y = 0; y < numChunksY; y++) {
+                        auto i = computeChunkIndex(chunkX * chunkWidth, y * chunkHeight, chunkZ * chunkDepth);
+                        if (!chunkCollisionMeshes[i] && (chunkElementCounts[i] > 0 || chunkRemeshStates[i])) {
+                            markChunkDirty(i);
+                        }
+                    }
+                }
+
+                continue;
+            }
+
+            // The heightfield replaces the collision meshes of the column's chunks
+            columnCollisionStates[column] = ColumnCollisionState::Heightfield;
+            for (size_t y = 0; y < numChunksY; y++) {
+                releaseChunkCollision(computeChunkIndex(chunkX * chunkWidth, y * chunkHeight, chunkZ * chunkDepth));
+            }
+
+            commitHeightfield(column);
+        }
+
+        dirtyColumns.clear();
+    }
+
+    bool VoxelTerrain::computeColumnHeights(size_t column, std::vector<float>& heights) {
+        auto startX = (column % numChunksX) * chunkWidth;
+        auto startZ = (column / numChunksX) * chunkDepth;
+        auto sizeX = std::min(startX + chunkWidth, getWidth() - 1) - startX + 1;
+        auto sizeZ = std::min(startZ + chunkDepth, getDepth() - 1) - startZ + 1;
+        auto height = getHeight();
+
+        columnVoxels.resize(sizeX * height * sizeZ);
+        voxels->copyBlock(startX, 0, startZ, sizeX, height, sizeZ, columnVoxels.data());
+
+        // Bullet lays out the rows of a heightfield along +z, the terrain along -z, so they are stored backwards
+        heights.resize(sizeX * sizeZ);
+        for (size_t z = 0; z < sizeZ; z++)
+        for (size_t x = 0; x < sizeX; x++) {
+            auto voxel = [&](size_t y) {
+                return static_cast<VoxelType>(columnVoxels[x + y * sizeX + z * sizeX * height]);
+            };
+
+            auto top = height;
+            while (top > 0 && voxel(top - 1) != VoxelType::Solid) {
+                top--;
+            }
+
+            if (top == 0) {
+                return false;
+            }
+
+            for (size_t y = 0; y + 1 < top; y++) {
+                if (voxel(y) != VoxelType::Solid) {
+                    return false;
+                }
+            }
+
+            // Marching cubes puts the surface on the empty voxel above the top one, but not above the last cells
+            heights[x + (sizeZ - 1 - z) * sizeX] = static_cast<float>(std::min(top, height - 1));
+        }
+
+        return true;
+    }
+
+    void VoxelTerrain::commitHeightfield(size_t column) {
+        const auto& heights = columnHeights[column];
+        auto startX = (column % numChunksX) * chunkWidth;
+        auto startZ = (column / numChunksX) * chunkDepth;
+        auto numCellsX = std::min(startX + chunkWidth, getWidth() - 1) - startX;
+        auto numCellsZ = std::min(startZ + chunkDepth, getDepth() - 1) - startZ;
+        auto minMaxHeight = std::minmax_element(heights.begin(), heights.end());
+
+        // The shape is cheap to create, and its bounds change with the heights. Bullet centers it on its bounds.
+        std::unique_ptr<btHeightfieldTerrainShape> shape(new btHeightfieldTerrainShape(
+            static_cast<int>(numCellsX + 1), static_cast<int>(numCellsZ + 1), heights.data(), 1,
+            *minMaxHeight.first, *minMaxHeight.second, 1, PHY_FLOAT, false));
+        btTransform transform(btQuaternion::getIdentity(), btVector3(startX + numCellsX * 0.5f,
+            (*minMaxHeight.first + *minMaxHeight.second) * 0.5f, -(startZ + numCellsZ * 0.5f)));
+
+        auto& rigidBody = columnHeightfieldBodies[column];
+        if (rigidBody) {
+            rigidBody->setCollisionShape(shape.get());
+            rigidBody->setWorldTransform(transform);
+            dynamicsWorld->getBroadphase()->getOverlappingPairCache()->cleanProxyFromPairs(
+                rigidBody->getBroadphaseHandle(), dynamicsWorld->getDispatcher());
+            dynamicsWorld->updateSingleAabb(rigidBody.get());
+        }
+        else {
+            btRigidBody::btRigidBodyConstructionInfo heightfieldCI(0, nullptr, shape.get(), btVector3(0, 0, 0));
+            heightfieldCI.m_startWorldTransform = transform;
+            rigidBody.reset(new btRigidBody(heightfieldCI));
+            dynamicsWorld->addRigidBody(rigidBody.get(), TerrainCollisionFilter,
+                btBroadphaseProxy::AllFilter ^ btBroadphaseProxy::StaticFilter);
+
+            if (!columnHeightfieldListed[column]) {
+                columnHeightfieldListed[column] = 1;
+                heightfieldColumns.push_back(column);
+            }
+        }
+
+        columnHeightfieldShapes[column] = std::move(shape);
+    }
+
+    void VoxelTerrain::releaseHeightfield(size_t column) {
+        auto& rigidBody = columnHeightfieldBodies[column];
+        if (rigidBody) {
+            dynamicsWorld->removeRigidBody(rigidBody.get());
+            rigidBody.reset();
+        }
+
+        columnHeightfieldShapes[column].reset();
+        std::vector<float>().swap(columnHeights[column]);
+    }
+
+    bool VoxelTerrain::hasColumnCollision(size_t column) const {
+        if (columnHeightfieldBodies[column]) {
+            return true;
+        }
+
+        auto chunkX = column % numChunksX;
+        auto chunkZ = column / numChunksX;
+        for (size_t y = 0; y < numChunksY; y++) {
+            if (chunkCollisionMeshes[computeChunkIndex(chunkX * chunkWidth, y * chunkHeight, chunkZ * chunkDepth)]) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void VoxelTerrain::setAsyncRemeshEnabled(bool enabled) {
+        isAsyncRemeshEnabled = enabled;
+    }
+
+    void VoxelTerrain::setMaxRemeshLatency(size_t frames) {
+        maxRemeshLatency = frames;
+    }
+
+    size_t VoxelTerrain::getNumChunksRemeshed() const {
+        return numChunksRemeshed;
+    }
+
+    void VoxelTerrain::setCollisionType(TerrainCollisionType type) {
+        if (type == collisionType) {
+            return;
+        }
+
+        collisionType = type;
+        auto numChunks = numChunksX * numChunksY * numChunksZ;
+        auto numColumns = numChunksX * numChunksZ;
+        for (size_t i = 0; i < numColumns; i++) {
+            markColumnDirty(i);
+        }
+
+        if (type == TerrainCollisionType::VoxelShape) {
+            for (size_t i = 0; i < numChunks; i++) {
+                releaseChunkCollision(i);
+            }
+
+            for (size_t i = 0; i < numColumns; i++) {
+                releaseHeightfield(i);
+            }
+
+            voxelShape.reset(new VoxelTerrainShape(*voxels, chunkWidth, chunkHeight, chunkDepth, VoxelShapeCacheSize));
+            btRigidBody::btRigidBodyConstructionInfo rigidBodyCI(0, nullptr, voxelShape.get(), btVector3(0, 0, 0));
+            voxelShapeBody.reset(new btRigidBody(rigidBodyCI));
+            dynamicsWorld->addRigidBody(voxelShapeBody.get(), TerrainCollisionFilter,
+                btBroadphaseProxy::AllFilter ^ btBroadphaseProxy::StaticFilter);
+        }
+        else {
+            if (voxelShapeBody) {
+                dynamicsWorld->removeRigidBody(voxelShapeBody.get());
+                voxelShapeBody.reset();
+                voxelShape.reset();
+            }
+
+            // The chunk meshes are built by the next remeshes, lazily only the ones near dynamic bodies.
+            // Chunks in heightfield columns are left alone.
+            for (size_t i = 0; i < numChunks; i++) {
+                if (!chunkCollisionMeshes[i] && (chunkElementCounts[i] > 0 || chunkRemeshStates[i]) &&
+                    columnCollisionStates[getChunkColumn(i)] != ColumnCollisionState::Heightfield) {
+                    markChunkDirty(i);
+                }
+            }
+        }
+    }
+
+    void VoxelTerrain::setHeightfieldCollisionEnabled(bool enabled) {
+        if (enabled == isHeightfieldCollisionEnabled) {
+            return;
+        }
+
+        isHeightfieldCollisionEnabled = enabled;
+        for (size_t i = 0; i < numChunksX * numChunksZ; i++) {
+            markColumnDirty(i);
+        }
+    }
+
+    size_t VoxelTerrain::getNumCollisionChunks() const {
+        return static_cast<size_t>(std::count_if(chunkRigidBodies.begin(), chunkRigidBodies.end(),
+            [](const std::unique_ptr<btRigidBody>& body) { return body != nullptr; }));
+    }
+
+    size_t VoxelTerrain::getNumHeightfieldColumns() const {
+        return static_cast<size_t>(std::count_if(columnHeightfieldBodies.begin(), columnHeightfieldBodies.end(),
+            [](const std::unique_ptr<btRigidBody>& body) { return body != nullptr; }));
+    }
+
+    size_t VoxelTerrain::getCollisionMemoryUsage() const {
+        size_t usage = 0;
+        auto numChunks = numChunksX * numChunksY * numChunksZ;
+        for (size_t i = 0; i < numChunks; i++) {
+            if (chunkCollisionMeshes[i]) {
+                usage += chunkCollisionMeshes[i]->getMemoryUsage();
+                usage += chunkVertices[i].capacity() * sizeof(Vertex) + chunkIndices[i].capacity() * sizeof(uint32_t);
+            }
+
+            if (chunkRigidBodies[i]) {
+                usage += sizeof(btRigidBody);
+            }
+        }
+
+        for (size_t i = 0; i < numChunksX * numChunksZ; i++) {
+            if (columnHeightfieldBodies[i]) {
+                usage += columnHeights[i].capacity() * sizeof(float) + sizeof(btHeightfieldTerrainShape) + sizeof(btRigidBody);
+            }
+        }
+
+        usage += columnVoxels.capacity();
+
+        // Idle jobs keep their collision meshes for the next remeshes
+        for (const auto& job : freeJobs) {
+            if (job->build.collisionMesh) {
+                usage += job->build.collisionMesh->getMemoryUsage();
+            }
+        }
+
+        if (voxelShape) {
+            usage += voxelShape->getMemoryUsage() + sizeof(btRigidBody);
+        }
+
+        return usage;
+    }
+
+    void VoxelTerrain::attachCamera(const Camera& camera) {
+        cameras.push_back(&camera);
+    }
+
+    void VoxelTerrain::setRemeshBudget(float milliseconds) {
+        remeshBudget = milliseconds;
+    }
+
+    size_t VoxelTerrain::getRemeshBacklogSize() const {
+        return dirtyChunks.size();
+    }
+
+    size_t VoxelTerrain::getRemeshBacklogAge() const {
+        return remeshBacklogAge;
+    }
+
     VoxelTerrain VoxelTerrain::fromHeightMap(const std::string& path, btDiscreteDynamicsWorld* dynamicsWorld,
-            size_t chunkWidth, size_t chunkHeight, size_t chunkDepth, size_t invHeightScale) {
+            size_t chunkWidth, size_t chunkHeight, size_t chunkDepth, size_t invHeightScale,
+            VoxelStorageType storageType, TerrainCollisionType collisionType, bool useHeightfields) {
         Image heightMap(path);
 
         size_t maxHeight = 1;
@@ -162,7 +869,9 @@ namespace tankwars {
         }
 
         VoxelTerrain terrain(dynamicsWorld, numChunksX, numChunksY, numChunksZ,
-            chunkWidth, chunkHeight, chunkDepth);
+            chunkWidth, chunkHeight, chunkDepth, storageType);
+        terrain.setCollisionType(collisionType);
+        terrain.setHeightfieldCollisionEnabled(useHeightfields);
 
         for (int z = 0; z < heightMap.getHeight(); z++)
         for (int x = 0; x < heightMap.getWidth(); x++) {
@@ -174,9 +883,7 @@ namespace tankwars {
                 heightValue = std::min(heightValue + 4, static_cast<int>(terrain.getHeight() - 1));
             }
             
-            for (int y = 0; y <= heightValue; y++) {
-                terrain.setVoxel(x, y, z, VoxelType::Solid);
-            }
+            terrain.fillColumn(x, z, 0, heightValue + 1, VoxelType::Solid);
         }
 
         terrain.updateMesh();
@@ -187,68 +894,152 @@ namespace tankwars {
         return (x / chunkWidth) + (y / chunkHeight) * numChunksX + (z / chunkDepth) * numChunksX * numChunksY;
     }
 
-    void VoxelTerrain::updateChunk(size_t startX, size_t startY, size_t startZ) {
-        static std::vector<glm::vec3> posCache;
-        static std::vector<glm::vec3> normalCache;
-        static std::vector<Vertex> vertexCache;
-        static std::vector<uint32_t> indexCache;
+    const std::vector<VoxelTerrain::SphereSpan>& VoxelTerrain::getSphereStencil(float radius) {
+        auto& stencil = sphereStencils[radius];
+        if (!stencil.empty()) {
+            return stencil;
+        }
+
+        // The voxels closer than radius to the center voxel, as one vertical span per column
+        auto maxOffset = static_cast<int>(std::ceil(radius));
+        for (auto dz = -maxOffset; dz <= maxOffset; dz++)
+        for (auto dx = -maxOffset; dx <= maxOffset; dx++) {
+            if (static_cast<float>(dx * dx + dz * dz) >= radius * radius) {
+                continue;
+            }
+
+            auto dy = 0;
+            while (static_cast<float>(dx * dx + (dy + 1) * (dy + 1) + dz * dz) < radius * radius) {
+                dy++;
+            }
+
+            stencil.push_back({ dx, dz, dy });
+        }
+
+        return stencil;
+    }
+
+    void VoxelTerrain::fillSpan(long long x, long long z, long long beginY, long long endY, VoxelType voxel,
+                                const VoxelBox& bounds, VoxelBox& changed) {
+        auto clamp = [](long long value, size_t begin, size_t end) {
+            return static_cast<size_t>(std::min(std::max(value, static_cast<long long>(begin)),
+                                                static_cast<long long>(end)));
+        };
+
+        auto endX = std::min(bounds.endX, getWidth());
+        auto endZ = std::min(bounds.endZ, getDepth());
+        if (x < static_cast<long long>(bounds.beginX) || x >= static_cast<long long>(endX) ||
+            z < static_cast<long long>(bounds.beginZ) || z >= static_cast<long long>(endZ)) {
+            return;
+        }
+
+        auto clampedBeginY = clamp(beginY, bounds.beginY, std::min(bounds.endY, getHeight()));
+        auto clampedEndY = clamp(endY, bounds.beginY, std::min(bounds.endY, getHeight()));
+        if (clampedBeginY < clampedEndY && voxels->fillColumn(x, z, clampedBeginY, clampedEndY, voxel)) {
+            changed.beginX = std::min(changed.beginX, static_cast<size_t>(x));
+            changed.beginY = std::min(changed.beginY, clampedBeginY);
+            changed.beginZ = std::min(changed.beginZ, static_cast<size_t>(z));
+            changed.endX = std::max(changed.endX, static_cast<size_t>(x) + 1);
+            changed.endY = std::max(changed.endY, clampedEndY);
+            changed.endZ = std::max(changed.endZ, static_cast<size_t>(z) + 1);
+        }
+    }
+
+    void VoxelTerrain::markChunkEdited(size_t chunkIndex) {
+        if (voxelShape) {
+            voxelShape->invalidateChunk(chunkIndex);
+        }
+
+        markColumnDirty(getChunkColumn(chunkIndex));
+        markChunkDirty(chunkIndex);
+    }
+
+    void VoxelTerrain::markChunkDirty(size_t chunkIndex) {
+        if (!chunkDirtyStates[chunkIndex]) {
+            chunkDirtyStates[chunkIndex] = 1;
+            chunkDirtyFrames[chunkIndex] = remeshFrame;
+            dirtyChunks.push_back(chunkIndex);
+        }
+    }
+
+    void VoxelTerrain::markRegionDirty(const VoxelBox& box) {
+        if (box.beginX >= box.endX || box.beginY >= box.endY || box.beginZ >= box.endZ) {
+            return;
+        }
+
+        // A voxel on the lower border of a chunk is also a corner of the cells of the chunk before it
+        auto beginChunkX = (std::max(box.beginX, static_cast<size_t>(1)) - 1) / chunkWidth;
+        auto beginChunkY = (std::max(box.beginY, static_cast<size_t>(1)) - 1) / chunkHeight;
+        auto beginChunkZ = (std::max(box.beginZ, static_cast<size_t>(1)) - 1) / chunkDepth;
+        auto endChunkX = (box.endX - 1) / chunkWidth;
+        auto endChunkY = (box.endY - 1) / chunkHeight;
+        auto endChunkZ = (box.endZ - 1) / chunkDepth;
+
+        for (auto z = beginChunkZ; z <= endChunkZ; z++)
+        for (auto y = beginChunkY; y <= endChunkY; y++)
+        for (auto x = beginChunkX; x <= endChunkX; x++) {
+            markChunkEdited(x + y * numChunksX + z * numChunksX * numChunksY);
+        }
+    }
+
+    bool VoxelTerrain::captureChunk(size_t chunkIndex, ChunkBuild& build) const {
+        build.chunkIndex = chunkIndex;
+        // Lazily, a chunk gets a collision mesh if a dynamic body is near, and keeps it until it's evicted
+        build.hasCollisionMesh = collisionType == TerrainCollisionType::ChunkMeshes;
+        if (collisionType == TerrainCollisionType::LazyChunkMeshes) {
+            auto framesUnused = remeshFrame - chunkCriticalFrames[chunkIndex];
+            build.hasCollisionMesh = framesUnused == 0 ||
+                (chunkCollisionMeshes[chunkIndex] && framesUnused <= CollisionEvictionFrames);
+        }
+
+        auto columnState = columnCollisionStates[getChunkColumn(chunkIndex)];
+        build.hasCollisionMesh = build.hasCollisionMesh && columnState != ColumnCollisionState::Heightfield;
+        build.startX = (chunkIndex % numChunksX) * chunkWidth;
+        build.startY = ((chunkIndex / numChunksX) % numChunksY) * chunkHeight;
+        build.startZ = (chunkIndex / (numChunksX * numChunksY)) * chunkDepth;
+
+        // A cell needs the voxels on both of its sides, so the last cells of the terrain are left out
+        build.numCellsX = std::min(build.startX + chunkWidth, getWidth() - 1) - build.startX;
+        build.numCellsY = std::min(build.startY + chunkHeight, getHeight() - 1) - build.startY;
+        build.numCellsZ = std::min(build.startZ + chunkDepth, getDepth() - 1) - build.startZ;
+
+        // If all voxels the cells touch are the same, including the borders shared with the
+        // neighbouring chunks, there is no surface in the chunk
+        if (voxels->isBlockUniform(build.startX, build.startY, build.startZ,
+                                   build.numCellsX + 1, build.numCellsY + 1, build.numCellsZ + 1)) {
+            return false;
+        }
+
+        build.voxels.resize((build.numCellsX + 1) * (build.numCellsY + 1) * (build.numCellsZ + 1));
+        voxels->copyBlock(build.startX, build.startY, build.startZ,
+                          build.numCellsX + 1, build.numCellsY + 1, build.numCellsZ + 1, build.voxels.data());
+        return true;
+    }
+
+    void VoxelTerrain::buildChunk(ChunkBuild& build) const {
+        auto& posCache = build.positions;
+        auto& vertexCache = build.vertices;
+        auto& indexCache = build.indices;
 
         posCache.clear();
-        normalCache.clear();
         vertexCache.clear();
         indexCache.clear();
 
-        // Perform marching cubes on the chunk
-        GridCell gridCell;
-        auto endX = std::min(startX * chunkWidth + chunkWidth, getWidth() - 1);
-        auto endY = std::min(startY * chunkHeight + chunkHeight, getHeight() - 1);
-        auto endZ = std::min(startZ * chunkDepth + chunkDepth, getDepth() - 1);
-
-        for (size_t z = startZ * chunkDepth;  z < endZ; z++)
-        for (size_t y = startY * chunkHeight; y < endY; y++)
-        for (size_t x = startX * chunkWidth;  x < endX; x++) {
-            gridCell.positions[0] = glm::vec3(x,     y,     z + 1);
-            gridCell.positions[1] = glm::vec3(x + 1, y,     z + 1);
-            gridCell.positions[2] = glm::vec3(x + 1, y,     z);
-            gridCell.positions[3] = glm::vec3(x,     y,     z);
-            gridCell.positions[4] = glm::vec3(x,     y + 1, z + 1);
-            gridCell.positions[5] = glm::vec3(x + 1, y + 1, z + 1);
-            gridCell.positions[6] = glm::vec3(x + 1, y + 1, z);
-            gridCell.positions[7] = glm::vec3(x,     y + 1, z);
-
-            gridCell.values[0] = static_cast<uint8_t>(getVoxel(x,     y,     z + 1));
-            gridCell.values[1] = static_cast<uint8_t>(getVoxel(x + 1, y,     z + 1));
-            gridCell.values[2] = static_cast<uint8_t>(getVoxel(x + 1, y,     z));
-            gridCell.values[3] = static_cast<uint8_t>(getVoxel(x,     y,     z));
-            gridCell.values[4] = static_cast<uint8_t>(getVoxel(x,     y + 1, z + 1));
-            gridCell.values[5] = static_cast<uint8_t>(getVoxel(x + 1, y + 1, z + 1));
-            gridCell.values[6] = static_cast<uint8_t>(getVoxel(x + 1, y + 1, z));
-            gridCell.values[7] = static_cast<uint8_t>(getVoxel(x,     y + 1, z));
-
-            polygonize(gridCell, posCache, indexCache);
-        }
-
-        // If the marching cubes algorithm didn't return any geometry, the chunk is invisible.
-        // So ignore it when rendering and remove it from the physics world
-        auto chunkIndex = startX + startY * numChunksX + startZ * numChunksX * numChunksY;
-        if (posCache.empty()) {
-            chunkElementCounts[chunkIndex] = 0;
-
-            auto& rigidBody = chunkRigidBodies[chunkIndex];
-            if (rigidBody) {
-                dynamicsWorld->removeRigidBody(rigidBody.get());
-                rigidBody.reset();
-            }
+        // Perform marching cubes on the captured voxels. Cells share the vertices on their common edges.
+        glm::vec3 origin(build.startX, build.startY, build.startZ);
+        polygonizeBlock(build.voxels.data(), build.numCellsX, build.numCellsY, build.numCellsZ,
+                        origin, build.edgeCache, posCache, indexCache);
 
+        // If the marching cubes algorithm didn't return any geometry, the chunk is invisible
+        build.hasCollisionMesh = build.hasCollisionMesh && !posCache.empty();
+        if (posCache.empty()) {
             return;
         }
 
-        // Compute normals and vertices
-        if (normalCache.size() < posCache.size()) {
-            normalCache.resize(posCache.size(), glm::vec3(0.0f));
-        }
-        else {
-            std::fill(normalCache.begin(), normalCache.end(), glm::vec3(0.0f));
+        // Compute the vertices, the normals are summed up in place
+        vertexCache.reserve(posCache.size());
+        for (const auto& position : posCache) {
+            vertexCache.push_back({position, glm::vec3(0.0f)});
         }
 
         for (size_t i = 0; i < indexCache.size() / 3; i++) {
@@ -257,64 +1048,138 @@ namespace tankwars {
             auto p3 = posCache[indexCache[i * 3 + 2]];
             auto n = glm::cross(p2 - p1, p3 - p1);
 
-            normalCache[indexCache[i * 3]] += n;
-            normalCache[indexCache[i * 3 + 1]] += n;
-            normalCache[indexCache[i * 3 + 2]] += n;
+            vertexCache[indexCache[i * 3]].normal += n;
+            vertexCache[indexCache[i * 3 + 1]].normal += n;
+            vertexCache[indexCache[i * 3 + 2]].normal += n;
         }
 
-        for (auto& normal : normalCache) {
-            normal = glm::normalize(normal);
+        for (auto& vertex : vertexCache) {
+            vertex.normal = glm::normalize(vertex.normal);
+        }
+
+        // Build the collision mesh over the same vertices and indices. It is only handed to the
+        // dynamics world in commitChunk(), together with the arrays.
+        if (!build.hasCollisionMesh) {
+            return;
+        }
+
+        if (!build.collisionMesh) {
+            build.collisionMesh.reset(new ChunkCollisionMesh);
+        }
+
+        build.collisionMesh->rebuild(vertexCache, indexCache);
+    }
+
+    void VoxelTerrain::commitChunk(ChunkBuild& build) {
+        auto chunkIndex = build.chunkIndex;
+
+        // An invisible chunk is ignored when rendering and has no physical representation
+        if (build.indices.empty()) {
+            releaseChunk(chunkIndex);
+            return;
         }
 
-        if (vertexCache.capacity() < posCache.size()) {
-            vertexCache.reserve(posCache.size());
+        if (chunkVertexArrays[chunkIndex] == 0) {
+            glGenVertexArrays(1, &chunkVertexArrays[chunkIndex]);
+            glGenBuffers(1, &chunkVertexArrayBuffers[chunkIndex]);
+            glGenBuffers(1, &chunkElementBuffers[chunkIndex]);
+
+            glBindVertexArray(chunkVertexArrays[chunkIndex]);
+            glBindBuffer(GL_ARRAY_BUFFER, chunkVertexArrayBuffers[chunkIndex]);
+            glEnableVertexAttribArray(0);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), bufferOffset(sizeof(glm::vec3)));
+            glBindVertexArray(0);
         }
 
-        for (size_t i = 0; i < posCache.size(); i++) {
-            vertexCache.push_back({posCache[i], normalCache[i]});
+        // With chunk mesh collision, the chunk takes over the vertices and indices, which the collision
+        // mesh uses in place. Swapping the vectors keeps their memory where it is. The old arrays and the
+        // old collision mesh go back to the job to be rebuilt for another chunk.
+        // The chunk's column may have become a heightfield since the chunk was captured
+        auto hasCollisionMesh = build.hasCollisionMesh && collisionType != TerrainCollisionType::VoxelShape &&
+            columnCollisionStates[getChunkColumn(chunkIndex)] != ColumnCollisionState::Heightfield;
+        if (hasCollisionMesh) {
+            std::swap(chunkVertices[chunkIndex], build.vertices);
+            std::swap(chunkIndices[chunkIndex], build.indices);
+            std::swap(chunkCollisionMeshes[chunkIndex], build.collisionMesh);
+        }
+        else {
+            releaseChunkCollision(chunkIndex);
         }
-        
+
+        const auto& vertices = hasCollisionMesh ? chunkVertices[chunkIndex] : build.vertices;
+        const auto& indices = hasCollisionMesh ? chunkIndices[chunkIndex] : build.indices;
+
         // Upload the new geometry to the GPU
         glBindBuffer(GL_ARRAY_BUFFER, chunkVertexArrayBuffers[chunkIndex]);
-        glBufferData(GL_ARRAY_BUFFER, vertexCache.size() * sizeof(Vertex), vertexCache.data(), GL_STREAM_DRAW);
-        //glBufferSubData(GL_ARRAY_BUFFER, 0, vertexCache.size() * sizeof(Vertex), vertexCache.data());
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STREAM_DRAW);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, chunkElementBuffers[chunkIndex]);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCache.size() * sizeof(uint32_t), indexCache.data(), GL_STREAM_DRAW);
-        //glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indexCache.size() * sizeof(uint32_t), indexCache.data());
-        chunkElementCounts[chunkIndex] = static_cast<int>(indexCache.size());
-
-        // Recreate the collision mesh
-        auto& triangleMesh = chunkTriangleMeshes[chunkIndex];
-        triangleMesh.reset(new btTriangleMesh);
-        triangleMesh->preallocateVertices(static_cast<int>(indexCache.size() / 3));
-        triangleMesh->preallocateIndices(static_cast<int>(indexCache.size()));
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STREAM_DRAW);
+        chunkElementCounts[chunkIndex] = static_cast<int>(indices.size());
 
-        for (size_t i = 0; i < indexCache.size() / 3; i++) {
-            auto index1 = indexCache[i * 3];
-            auto index2 = indexCache[i * 3 + 1];
-            auto index3 = indexCache[i * 3 + 2];
+        if (!hasCollisionMesh) {
+            return;
+        }
 
-            const auto& pos1 = posCache[index1];
-            const auto& pos2 = posCache[index2];
-            const auto& pos3 = posCache[index3];
+        // Swap in the new collision mesh. The chunk keeps its rigid body, only the shape is exchanged.
+        auto shape = chunkCollisionMeshes[chunkIndex]->getShape();
+        auto& rigidBody = chunkRigidBodies[chunkIndex];
+        if (rigidBody) {
+            // The contacts and collision algorithms of the body still refer to the old shape
+            rigidBody->setCollisionShape(shape);
+            dynamicsWorld->getBroadphase()->getOverlappingPairCache()->cleanProxyFromPairs(
+                rigidBody->getBroadphaseHandle(), dynamicsWorld->getDispatcher());
+            dynamicsWorld->updateSingleAabb(rigidBody.get());
+        }
+        else {
+            btRigidBody::btRigidBodyConstructionInfo groundRigidBodyCI(0, nullptr, shape, btVector3(0, 0, 0));
+            rigidBody.reset(new btRigidBody(groundRigidBodyCI));
+            dynamicsWorld->addRigidBody(rigidBody.get(), TerrainCollisionFilter,
+                btBroadphaseProxy::AllFilter ^ btBroadphaseProxy::StaticFilter);
 
-            triangleMesh->addTriangle(
-                btVector3(pos1.x, pos1.y, pos1.z),
-                btVector3(pos2.x, pos2.y, pos2.z),
-                btVector3(pos3.x, pos3.y, pos3.z));
+            if (!chunkCollisionListed[chunkIndex]) {
+                chunkCollisionListed[chunkIndex] = 1;
+                collisionChunks.push_back(chunkIndex);
+            }
         }
+    }
 
+    void VoxelTerrain::releaseChunkCollision(size_t chunkIndex) {
         auto& rigidBody = chunkRigidBodies[chunkIndex];
         if (rigidBody) {
             dynamicsWorld->removeRigidBody(rigidBody.get());
+            rigidBody.reset();
+        }
+
+        chunkCollisionMeshes[chunkIndex].reset();
+        std::vector<Vertex>().swap(chunkVertices[chunkIndex]);
+        std::vector<uint32_t>().swap(chunkIndices[chunkIndex]);
+    }
+
+    void VoxelTerrain::releaseChunk(size_t chunkIndex) {
+        releaseChunkCollision(chunkIndex);
+        chunkElementCounts[chunkIndex] = 0;
+
+        if (chunkVertexArrays[chunkIndex] != 0) {
+            glDeleteVertexArrays(1, &chunkVertexArrays[chunkIndex]);
+            glDeleteBuffers(1, &chunkVertexArrayBuffers[chunkIndex]);
+            glDeleteBuffers(1, &chunkElementBuffers[chunkIndex]);
+            chunkVertexArrays[chunkIndex] = 0;
+            chunkVertexArrayBuffers[chunkIndex] = 0;
+            chunkElementBuffers[chunkIndex] = 0;
         }
-        
-        chunkCollisionMeshes[chunkIndex].reset(new btBvhTriangleMeshShape(triangleMesh.get(), true));
-        chunkMotionStates[chunkIndex].reset(new btDefaultMotionState(btTransform(btQuaternion(0, 0, 0, 1), btVector3(0, 0, 0))));
-        btRigidBody::btRigidBodyConstructionInfo groundRigidBodyCI(0, chunkMotionStates[chunkIndex].get(),
-                                                                   chunkCollisionMeshes[chunkIndex].get(), btVector3(0, 0, 0));
-        rigidBody.reset(new btRigidBody(groundRigidBodyCI));
-        dynamicsWorld->addRigidBody(rigidBody.get());
+    }
+
+    void VoxelTerrain::finishJob(RemeshJob& job) {
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.isFinished = true;
+        job.finished.notify_all();
+    }
+
+    void VoxelTerrain::waitForJob(RemeshJob& job) {
+        std::unique_lock<std::mutex> lock(job.mutex);
+        job.finished.wait(lock, [&job]() { return job.isFinished; });
     }
 }
\ No newline at end of file
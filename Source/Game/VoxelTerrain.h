@@ -3,25 +3,41 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <unordered_map>
 #include <cstdint>
 #include <cstddef>
+#include <mutex>
+#include <condition_variable>
 
 #include <GL/gl3w.h>
 #include <btBulletDynamicsCommon.h>
+#include <BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h>
 
 #include "Mesh.h"
+#include "WorkerPool.h"
+#include "MarchingCubes.h"
+#include "VoxelStorage.h"
+#include "ChunkCollisionMesh.h"
+#include "VoxelTerrainShape.h"
 
 namespace tankwars {
-    enum class VoxelType : uint8_t {
-        Empty = 0,
-        Solid = 1
+    class Camera;
+
+    // Collision filter group of the terrain's rigid bodies, so ray tests can leave the terrain out
+    constexpr short TerrainCollisionFilter = 0x40;
+
+    enum class TerrainCollisionType {
+        ChunkMeshes,        // A BVH triangle mesh per chunk, rebuilt with the chunk's render mesh
+        LazyChunkMeshes,    // Chunk meshes only for the chunks near dynamic bodies, dropped once they left
+        VoxelShape          // One shape over all voxels, whose triangles are generated when Bullet queries them
     };
 
     class VoxelTerrain {
     public:
         VoxelTerrain(btDiscreteDynamicsWorld* dynamicsWorld,
             size_t numChunksX, size_t numChunksY, size_t numChunksZ,
-            size_t chunkWidth, size_t chunkHeight, size_t chunkDepth);
+            size_t chunkWidth, size_t chunkHeight, size_t chunkDepth,
+            VoxelStorageType storageType = VoxelStorageType::Byte);
         VoxelTerrain(const VoxelTerrain&) = default;
         VoxelTerrain(VoxelTerrain&&) = default;
         ~VoxelTerrain();
@@ -32,33 +48,232 @@ namespace tankwars {
         size_t getHeight() const;
         size_t getDepth() const;
 
+        // Bulk edits, which mark every chunk they change dirty once. They work on vertical
+        // spans of voxels and leave the voxels outside of bounds alone.
+        void fillColumn(size_t x, size_t z, size_t beginY, size_t endY, VoxelType voxel);
+        void fillBox(const VoxelBox& box, VoxelType voxel);
+
+        // The sphere is centered on the voxel closest to center
+        void fillSphere(const glm::vec3& center, float radius, VoxelType voxel,
+                        const VoxelBox& bounds = VoxelBox());
+
+        // Fills several spheres at once. Overlapping spheres are merged, so every voxel is written once.
+        void fillSpheres(const std::vector<glm::vec3>& centers, float radius, VoxelType voxel,
+                         const VoxelBox& bounds = VoxelBox());
+
+        // An upright cylinder standing on baseCenter
+        void fillCylinder(const glm::vec3& baseCenter, float radius, float height, VoxelType voxel,
+                          const VoxelBox& bounds = VoxelBox());
+
+        // Returns one more than the highest solid voxel below endY in the column at (x, z), 0 if there is none
+        size_t getColumnTop(size_t x, size_t z, size_t endY) const;
+
+        // Bytes used by the voxel data
+        size_t getVoxelMemoryUsage() const;
+
         void render() const;
+
+        // Call once per frame. Remeshes the dirty chunks and swaps in finished chunks.
         void updateMesh();
 
+        // In async mode the dirty chunks are remeshed in the background while the old
+        // geometry stays in use. A finished chunk is swapped in at the latest after
+        // maxRemeshLatency calls to updateMesh(), the main thread waits for it otherwise.
+        void setAsyncRemeshEnabled(bool enabled);
+        void setMaxRemeshLatency(size_t frames);
+
+        // Number of dirty chunks the last updateMesh() call remeshed, including the ones it found empty
+        size_t getNumChunksRemeshed() const;
+
+        // Switching to chunk meshes remeshes every chunk
+        void setCollisionType(TerrainCollisionType type);
+
+        // With chunk meshes, chunk columns without overhangs, like all of a freshly loaded map, collide
+        // against a heightfield of their voxel column tops instead. An edit that leaves an overhang or
+        // a hole switches the column back to chunk meshes. On by default.
+        void setHeightfieldCollisionEnabled(bool enabled);
+
+        // Number of chunks with a collision mesh and of chunk columns with a heightfield, and the bytes
+        // used by the terrain's collision shapes, BVHs, heights and rigid bodies, including the vertices
+        // and indices they keep on the CPU
+        size_t getNumCollisionChunks() const;
+        size_t getNumHeightfieldColumns() const;
+        size_t getCollisionMemoryUsage() const;
+
+        // Dirty chunks are remeshed closest to the attached cameras first. Chunks that dynamic
+        // bodies (tanks, bullets) touch or are about to touch come before all others.
+        void attachCamera(const Camera& camera);
+
+        // Limits the time updateMesh() spends on starting remeshes, the rest of the dirty chunks is
+        // left for the next frames. Chunks near dynamic bodies are always remeshed. 0 means no limit.
+        void setRemeshBudget(float milliseconds);
+
+        // Number of dirty chunks left after the last updateMesh() call, and how many
+        // calls the oldest of them has been waiting
+        size_t getRemeshBacklogSize() const;
+        size_t getRemeshBacklogAge() const;
+
         static VoxelTerrain fromHeightMap(const std::string& path, btDiscreteDynamicsWorld* dynamicsWorld,
-            size_t chunkWidth, size_t chunkHeight, size_t chunkDepth, size_t invHeightScale);
+            size_t chunkWidth, size_t chunkHeight, size_t chunkDepth, size_t invHeightScale,
+            VoxelStorageType storageType = VoxelStorageType::Byte,
+            TerrainCollisionType collisionType = TerrainCollisionType::ChunkMeshes,
+            bool useHeightfields = true);
 		
     private:
+        // The CPU side of a chunk remesh, which can be built on any thread
+        struct ChunkBuild {
+            // Copy of the voxels the chunk's cells touch, so building doesn't race with setVoxel()
+            size_t chunkIndex;
+            size_t startX, startY, startZ;
+            size_t numCellsX, numCellsY, numCellsZ;
+            std::vector<uint8_t> voxels;
+
+            EdgeCache edgeCache;
+            std::vector<glm::vec3> positions;
+            std::vector<Vertex> vertices;
+            std::vector<uint32_t> indices;
+            bool hasCollisionMesh;
+            std::unique_ptr<ChunkCollisionMesh> collisionMesh; // Swapped with the chunk's one on commit
+        };
+
+        // The voxels [center.y - dy, center.y + dy] of the column at center + (dx, dz)
+        struct SphereSpan {
+            int dx, dz, dy;
+        };
+
+        const std::vector<SphereSpan>& getSphereStencil(float radius);
+
+        // A span of a column, used to merge edits
+        struct ColumnSpan {
+            long long x, z;
+            long long beginY, endY;
+        };
+
+        // Fills the part of the span inside bounds, growing changed by the voxels that changed
+        void fillSpan(long long x, long long z, long long beginY, long long endY, VoxelType voxel,
+                      const VoxelBox& bounds, VoxelBox& changed);
+        // Edited chunks are remeshed and their column's collision is looked at again
+        void markChunkEdited(size_t chunkIndex);
+        void markChunkDirty(size_t chunkIndex);
+        void markRegionDirty(const VoxelBox& box);
+
+        // A dirty chunk that can be remeshed this frame
+        struct RemeshCandidate {
+            size_t chunkIndex;
+            float priority; // Squared distance to the closest camera, -1 if a dynamic body is near
+        };
+
+        // Flags the chunks and chunk columns near dynamic bodies with the current remesh frame
+        // and collects the ones that weren't flagged yet
+        void markCollisionCriticalChunks();
+
+        // Marks the chunks near dynamic bodies without collision mesh dirty to get one, and releases
+        // the collision of the chunks and columns no dynamic body has been near for a while
+        void updateLazyCollision();
+
+        enum class ColumnCollisionState : uint8_t {
+            Unknown,        // Changed, with lazy collision left to be looked at once a body comes near
+            ChunkMeshes,    // Has overhangs or holes, or heightfields aren't used
+            Heightfield
+        };
+
+        // A chunk column is all chunks above the same x and z
+        size_t getChunkColumn(size_t chunkIndex) const;
+        void markColumnDirty(size_t column);
+
+        // Decides between heightfield and chunk meshes for the dirty columns, and rebuilds their heightfields
+        void updateHeightfields();
+
+        // Computes the surface height at every voxel column the cells of the chunk column touch.
+        // Returns false if any of them has an empty voxel below its top or no surface at all.
+        bool computeColumnHeights(size_t column, std::vector<float>& heights);
+
+        void commitHeightfield(size_t column);
+        void releaseHeightfield(size_t column);
+
+        // True if the column has a heightfield or any of its chunks a collision mesh
+        bool hasColumnCollision(size_t column) const;
+
         size_t computeChunkIndex(size_t x, size_t y, size_t z) const;
-        void updateChunk(size_t startX, size_t startY, size_t startZ);
+        // Returns false if the cells of the chunk can't contain any surface
+        bool captureChunk(size_t chunkIndex, ChunkBuild& build) const;
+        void buildChunk(ChunkBuild& build) const;
+        void commitChunk(ChunkBuild& build);
+
+        // Frees the geometry, GL objects and rigid body of a chunk without surface
+        void releaseChunk(size_t chunkIndex);
+        void releaseChunkCollision(size_t chunkIndex);
+
+        struct RemeshJob {
+            ChunkBuild build;
+            size_t frameStarted;
+            bool isFinished;
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+
+        void finishJob(RemeshJob& job);
+        void waitForJob(RemeshJob& job);
 
         // Terrain
         size_t numChunksX, numChunksY, numChunksZ;
         size_t chunkWidth, chunkHeight, chunkDepth;
-        std::vector<uint8_t> voxels;
-        
+        std::unique_ptr<VoxelStorage> voxels;
+        std::unordered_map<float, std::vector<SphereSpan>> sphereStencils;
+        std::vector<ColumnSpan> mergedSpans;
+
         // Rendering
         std::vector<GLuint> chunkVertexArrays;
         std::vector<GLuint> chunkVertexArrayBuffers;
         std::vector<GLuint> chunkElementBuffers;
         std::vector<GLsizei> chunkElementCounts;
         std::vector<uint8_t> chunkDirtyStates;
+        std::vector<size_t> dirtyChunks; // Every dirty chunk once, in the order they got dirty
+        std::vector<size_t> chunkDirtyFrames; // The remesh frame a chunk got dirty in
+
+        // Remeshing
+        std::unique_ptr<WorkerPool> workerPool;
+        std::vector<std::unique_ptr<RemeshJob>> pendingJobs;
+        std::vector<std::unique_ptr<RemeshJob>> freeJobs;
+        std::vector<uint8_t> chunkRemeshStates; // 1 if a job for the chunk is in flight
+        bool isAsyncRemeshEnabled = false;
+        size_t maxRemeshLatency = 2;
+        size_t remeshFrame = 0;
+        size_t numChunksRemeshed = 0;
+
+        // Remesh scheduling
+        std::vector<const Camera*> cameras;
+        std::vector<RemeshCandidate> remeshCandidates;
+        std::vector<size_t> chunkCriticalFrames; // The last remesh frame a dynamic body was near a chunk
+        std::vector<size_t> columnCriticalFrames;
+        std::vector<size_t> criticalChunks; // The chunks and columns flagged in this remesh frame
+        std::vector<size_t> criticalColumns;
+        float remeshBudget = 0;
+        float remeshCostEstimate = 0.5f; // Milliseconds per started chunk, averaged over the last frames
+        size_t remeshBacklogAge = 0;
 
         // Physics
         btDiscreteDynamicsWorld* dynamicsWorld;
-        std::vector<std::unique_ptr<btTriangleMesh>> chunkTriangleMeshes;
-        std::vector<std::unique_ptr<btBvhTriangleMeshShape>> chunkCollisionMeshes;
-        std::vector<std::unique_ptr<btDefaultMotionState>> chunkMotionStates;
+        std::vector<std::vector<Vertex>> chunkVertices; // Shared by the GL upload and the collision mesh
+        std::vector<std::vector<uint32_t>> chunkIndices;
+        std::vector<std::unique_ptr<ChunkCollisionMesh>> chunkCollisionMeshes;
         std::vector<std::unique_ptr<btRigidBody>> chunkRigidBodies;
+        std::vector<size_t> collisionChunks; // Every chunk that got a rigid body since the last eviction, once
+        std::vector<uint8_t> chunkCollisionListed; // 1 if the chunk is in collisionChunks
+
+        // Heightfield collision, per chunk column
+        bool isHeightfieldCollisionEnabled = true;
+        std::vector<ColumnCollisionState> columnCollisionStates;
+        std::vector<uint8_t> columnDirtyStates;
+        std::vector<size_t> dirtyColumns;
+        std::vector<std::vector<float>> columnHeights; // Referenced by the heightfield shapes
+        std::vector<std::unique_ptr<btHeightfieldTerrainShape>> columnHeightfieldShapes;
+        std::vector<std::unique_ptr<btRigidBody>> columnHeightfieldBodies;
+        std::vector<size_t> heightfieldColumns; // Like collisionChunks
+        std::vector<uint8_t> columnHeightfieldListed;
+        std::vector<uint8_t> columnVoxels;
+        TerrainCollisionType collisionType = TerrainCollisionType::ChunkMeshes;
+        std::unique_ptr<VoxelTerrainShape> voxelShape;
+        std::unique_ptr<btRigidBody> voxelShapeBody;
     };
 }
\ No newline at end of file
@@ -0,0 +1,230 @@
+#include "VoxelTerrainShape.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+
+namespace {
+    // A cached triangle inside the box of a query, copied out so the callback runs without the lock
+    struct QueryTriangle {
+        glm::vec3 corners[3];
+        int partId;
+        int triangleIndex;
+    };
+
+    // Scratch memory of the queries. Every thread has its own, so queries only share the cache.
+    struct QueryScratch {
+        std::vector<uint8_t> blockVoxels;
+        tankwars::EdgeCache edgeCache;
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t> indices;
+        std::vector<QueryTriangle> triangles;
+    };
+
+    thread_local QueryScratch scratch;
+}
+
+namespace tankwars {
+    VoxelTerrainShape::VoxelTerrainShape(const VoxelStorage& voxels,
+        size_t chunkWidth, size_t chunkHeight, size_t chunkDepth, size_t cacheSize)
+            : voxels(voxels),
+              chunkWidth(chunkWidth),
+              chunkHeight(chunkHeight),
+              chunkDepth(chunkDepth),
+              numChunksX((voxels.getWidth() + chunkWidth - 1) / chunkWidth),
+              numChunksY((voxels.getHeight() + chunkHeight - 1) / chunkHeight),
+              numChunksZ((voxels.getDepth() + chunkDepth - 1) / chunkDepth),
+              cacheSize(cacheSize),
+              localScaling(1, 1, 1) {
+        m_shapeType = CUSTOM_CONCAVE_SHAPE_TYPE;
+    }
+
+    void VoxelTerrainShape::invalidateChunk(size_t chunkIndex) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto cached = cachedChunkLookup.find(chunkIndex);
+        if (cached == cachedChunkLookup.end()) {
+            return;
+        }
+
+        // The entry is kept at the end of the list, so its memory is reused by the next chunk
+        cached->second->chunkIndex = SIZE_MAX;
+        cachedChunks.splice(cachedChunks.end(), cachedChunks, cached->second);
+        cachedChunkLookup.erase(cached);
+    }
+
+    size_t VoxelTerrainShape::getMemoryUsage() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto usage = sizeof(*this);
+        for (const auto& chunk : cachedChunks) {
+            usage += sizeof(chunk) + chunk.positions.capacity() * sizeof(glm::vec3) +
+                chunk.indices.capacity() * sizeof(uint32_t);
+        }
+
+        return usage;
+    }
+
+    void VoxelTerrainShape::processAllTriangles(btTriangleCallback* callback,
+                                                const btVector3& aabbMin, const btVector3& aabbMax) const {
+        CellRange range;
+        if (!getCellRange(aabbMin, aabbMax, range)) {
+            return;
+        }
+
+        // Small boxes, like the ones of wheel rays and contacts, are cheaper to polygonize than
+        // to look up in whole chunks
+        auto numCells = (range.endX - range.beginX) * (range.endY - range.beginY) * (range.endZ - range.beginZ);
+        btVector3 triangle[3];
+        if (cacheSize == 0 || numCells <= chunkWidth * chunkHeight * chunkDepth) {
+            auto& positions = scratch.positions;
+            auto& indices = scratch.indices;
+            positions.clear();
+            indices.clear();
+            polygonizeCells(range, scratch.blockVoxels, scratch.edgeCache, positions, indices);
+
+            for (size_t i = 0; i < indices.size(); i += 3) {
+                for (int j = 0; j < 3; j++) {
+                    const auto& position = positions[indices[i + j]];
+                    triangle[j].setValue(position.x, position.y, position.z);
+                }
+
+                callback->processTriangle(triangle, 0, static_cast<int>(i / 3));
+            }
+
+            return;
+        }
+
+        auto& triangles = scratch.triangles;
+        triangles.clear();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto z = range.beginZ / chunkDepth; z <= (range.endZ - 1) / chunkDepth; z++)
+            for (auto y = range.beginY / chunkHeight; y <= (range.endY - 1) / chunkHeight; y++)
+            for (auto x = range.beginX / chunkWidth; x <= (range.endX - 1) / chunkWidth; x++) {
+                auto chunkIndex = x + y * numChunksX + z * numChunksX * numChunksY;
+                const auto& chunk = getChunk(chunkIndex);
+
+                // The chunk's triangles outside of the box are skipped
+                for (size_t i = 0; i < chunk.indices.size(); i += 3) {
+                    QueryTriangle queryTriangle;
+                    for (int j = 0; j < 3; j++) {
+                        queryTriangle.corners[j] = chunk.positions[chunk.indices[i + j]];
+                    }
+
+                    auto triangleMin = glm::min(glm::min(queryTriangle.corners[0], queryTriangle.corners[1]), queryTriangle.corners[2]);
+                    auto triangleMax = glm::max(glm::max(queryTriangle.corners[0], queryTriangle.corners[1]), queryTriangle.corners[2]);
+                    if (TestAabbAgainstAabb2(btVector3(triangleMin.x, triangleMin.y, triangleMin.z),
+                                             btVector3(triangleMax.x, triangleMax.y, triangleMax.z), aabbMin, aabbMax)) {
+                        queryTriangle.partId = static_cast<int>(chunkIndex);
+                        queryTriangle.triangleIndex = static_cast<int>(i / 3);
+                        triangles.push_back(queryTriangle);
+                    }
+                }
+            }
+        }
+
+        for (const auto& queryTriangle : triangles) {
+            for (int j = 0; j < 3; j++) {
+                const auto& corner = queryTriangle.corners[j];
+                triangle[j].setValue(corner.x, corner.y, corner.z);
+            }
+
+            callback->processTriangle(triangle, queryTriangle.partId, queryTriangle.triangleIndex);
+        }
+    }
+
+    void VoxelTerrainShape::getAabb(const btTransform& transform, btVector3& aabbMin, btVector3& aabbMax) const {
+        // The mesh spans the voxel centers, with z pointing the other way
+        btVector3 localMin(0, 0, -static_cast<btScalar>(voxels.getDepth() - 1));
+        btVector3 localMax(static_cast<btScalar>(voxels.getWidth() - 1), static_cast<btScalar>(voxels.getHeight() - 1), 0);
+        btTransformAabb(localMin, localMax, getMargin(), transform, aabbMin, aabbMax);
+    }
+
+    void VoxelTerrainShape::setLocalScaling(const btVector3& scaling) {
+        // The triangles are always in voxel units
+        localScaling = scaling;
+    }
+
+    const btVector3& VoxelTerrainShape::getLocalScaling() const {
+        return localScaling;
+    }
+
+    void VoxelTerrainShape::calculateLocalInertia(btScalar /*mass*/, btVector3& inertia) const {
+        // The terrain is static
+        inertia.setValue(0, 0, 0);
+    }
+
+    const char* VoxelTerrainShape::getName() const {
+        return "VoxelTerrain";
+    }
+
+    bool VoxelTerrainShape::getCellRange(const btVector3& aabbMin, const btVector3& aabbMax, CellRange& range) const {
+        // Cell x spans [x, x + 1], the last voxel of every axis has no cell of its own
+        auto toCells = [](btScalar min, btScalar max, size_t numVoxels, size_t& begin, size_t& end) {
+            auto numCells = static_cast<btScalar>(numVoxels - 1);
+            if (max < 0 || min > numCells) {
+                return false;
+            }
+
+            begin = static_cast<size_t>(std::max(std::floor(min), btScalar(0)));
+            end = static_cast<size_t>(std::min(std::floor(max) + 1, numCells));
+            begin = std::min(begin, end - 1);
+            return true;
+        };
+
+        return toCells(aabbMin.x(), aabbMax.x(), voxels.getWidth(), range.beginX, range.endX) &&
+               toCells(aabbMin.y(), aabbMax.y(), voxels.getHeight(), range.beginY, range.endY) &&
+               toCells(-aabbMax.z(), -aabbMin.z(), voxels.getDepth(), range.beginZ, range.endZ);
+    }
+
+    const VoxelTerrainShape::CachedChunk& VoxelTerrainShape::getChunk(size_t chunkIndex) const {
+        auto cached = cachedChunkLookup.find(chunkIndex);
+        if (cached != cachedChunkLookup.end()) {
+            cachedChunks.splice(cachedChunks.begin(), cachedChunks, cached->second);
+            return *cached->second;
+        }
+
+        // Reuse the least recently used entry once the cache is full
+        if (cachedChunks.size() < cacheSize) {
+            cachedChunks.emplace_front();
+        }
+        else {
+            cachedChunks.splice(cachedChunks.begin(), cachedChunks, std::prev(cachedChunks.end()));
+            cachedChunkLookup.erase(cachedChunks.front().chunkIndex);
+        }
+
+        auto& chunk = cachedChunks.front();
+        chunk.chunkIndex = chunkIndex;
+        chunk.positions.clear();
+        chunk.indices.clear();
+        cachedChunkLookup[chunkIndex] = cachedChunks.begin();
+
+        CellRange range;
+        range.beginX = (chunkIndex % numChunksX) * chunkWidth;
+        range.beginY = ((chunkIndex / numChunksX) % numChunksY) * chunkHeight;
+        range.beginZ = (chunkIndex / (numChunksX * numChunksY)) * chunkDepth;
+        range.endX = std::min(range.beginX + chunkWidth, voxels.getWidth() - 1);
+        range.endY = std::min(range.beginY + chunkHeight, voxels.getHeight() - 1);
+        range.endZ = std::min(range.beginZ + chunkDepth, voxels.getDepth() - 1);
+        polygonizeCells(range, scratch.blockVoxels, scratch.edgeCache, chunk.positions, chunk.indices);
+        return chunk;
+    }
+
+    void VoxelTerrainShape::polygonizeCells(const CellRange& range, std::vector<uint8_t>& blockVoxels,
+                                            EdgeCache& edgeCache, std::vector<glm::vec3>& outPositions,
+                                            std::vector<uint32_t>& outIndices) const {
+        auto numCellsX = range.endX - range.beginX;
+        auto numCellsY = range.endY - range.beginY;
+        auto numCellsZ = range.endZ - range.beginZ;
+        if (voxels.isBlockUniform(range.beginX, range.beginY, range.beginZ, numCellsX + 1, numCellsY + 1, numCellsZ + 1)) {
+            return;
+        }
+
+        blockVoxels.resize((numCellsX + 1) * (numCellsY + 1) * (numCellsZ + 1));
+        voxels.copyBlock(range.beginX, range.beginY, range.beginZ,
+                         numCellsX + 1, numCellsY + 1, numCellsZ + 1, blockVoxels.data());
+
+        glm::vec3 origin(range.beginX, range.beginY, range.beginZ);
+        polygonizeBlock(blockVoxels.data(), numCellsX, numCellsY, numCellsZ, origin, edgeCache, outPositions, outIndices);
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <btBulletCollisionCommon.h>
+#include <glm/glm.hpp>
+
+#include "MarchingCubes.h"
+#include "VoxelStorage.h"
+
+namespace tankwars {
+    // Collides against the voxels directly. The marching cubes triangles are generated when Bullet
+    // asks for the triangles in a box, so edits need no collision rebuild and nothing is stored per chunk.
+    // Boxes of more cells than a chunk are answered from a small cache of recently queried chunks,
+    // which the terrain invalidates on edits.
+    // Queries can run on several threads at once. They only take turns while they look up the
+    // cache, the triangles are handed to the callbacks without holding the lock.
+    class VoxelTerrainShape : public btConcaveShape {
+    public:
+        // cacheSize is the number of chunks whose triangles are kept. With 0, only the cells
+        // overlapping the box are polygonized for every query, no matter its size.
+        VoxelTerrainShape(const VoxelStorage& voxels, size_t chunkWidth, size_t chunkHeight, size_t chunkDepth,
+                          size_t cacheSize);
+
+        // Call whenever a voxel of the chunk's cells changed
+        void invalidateChunk(size_t chunkIndex);
+
+        // Bytes used by the cached triangles, without the scratch memory of the querying threads
+        size_t getMemoryUsage() const;
+
+        void processAllTriangles(btTriangleCallback* callback, const btVector3& aabbMin, const btVector3& aabbMax) const override;
+        void getAabb(const btTransform& transform, btVector3& aabbMin, btVector3& aabbMax) const override;
+        void setLocalScaling(const btVector3& scaling) override;
+        const btVector3& getLocalScaling() const override;
+        void calculateLocalInertia(btScalar mass, btVector3& inertia) const override;
+        const char* getName() const override;
+
+    private:
+        struct CachedChunk {
+            size_t chunkIndex;
+            std::vector<glm::vec3> positions;
+            std::vector<uint32_t> indices;
+        };
+
+        // The cells [begin, end) on every axis
+        struct CellRange {
+            size_t beginX, beginY, beginZ;
+            size_t endX, endY, endZ;
+        };
+
+        // Returns false if the box doesn't overlap any cell
+        bool getCellRange(const btVector3& aabbMin, const btVector3& aabbMax, CellRange& range) const;
+
+        // Returns the triangles of the chunk, polygonizing it if it isn't cached
+        const CachedChunk& getChunk(size_t chunkIndex) const;
+
+        void polygonizeCells(const CellRange& range, std::vector<uint8_t>& blockVoxels, EdgeCache& edgeCache,
+                             std::vector<glm::vec3>& outPositions, std::vector<uint32_t>& outIndices) const;
+
+        const VoxelStorage& voxels;
+        size_t chunkWidth, chunkHeight, chunkDepth;
+        size_t numChunksX, numChunksY, numChunksZ;
+        size_t cacheSize;
+        btVector3 localScaling;
+
+        // Most recently used chunk first
+        mutable std::list<CachedChunk> cachedChunks;
+        mutable std::unordered_map<size_t, std::list<CachedChunk>::iterator> cachedChunkLookup;
+
+        // Guards the cache against queries from the parallel narrowphase
+        mutable std::mutex mutex;
+    };
+}
@@ -0,0 +1,43 @@
+#include "VoxelVehicleRaycaster.h"
+
+#include "VoxelTerrain.h"
+
+namespace tankwars {
+    VoxelVehicleRaycaster::VoxelVehicleRaycaster(const VoxelTerrain& terrain, btDynamicsWorld* dynamicsWorld)
+        : terrain(terrain),
+          dynamicsWorld(dynamicsWorld),
+          terrainRaycaster(terrain) {
+    }
+
+    void* VoxelVehicleRaycaster::castRay(const btVector3& from, const btVector3& to, btVehicleRaycasterResult& result) {
+        btScalar terrainFraction = 1;
+        btVector3 terrainNormal;
+        auto hitsTerrain = terrainRaycaster.castRay(from, to, terrainFraction, terrainNormal);
+
+        // Other objects only matter if they are in front of the terrain. The terrain's own bodies are left out.
+        auto end = from.lerp(to, terrainFraction);
+        btCollisionWorld::ClosestRayResultCallback rayCallback(from, end);
+        rayCallback.m_collisionFilterMask = btBroadphaseProxy::AllFilter ^ TerrainCollisionFilter;
+        dynamicsWorld->rayTest(from, end, rayCallback);
+
+        if (rayCallback.hasHit()) {
+            auto body = btRigidBody::upcast(rayCallback.m_collisionObject);
+            if (body && body->hasContactResponse()) {
+                result.m_hitPointInWorld = rayCallback.m_hitPointWorld;
+                result.m_hitNormalInWorld = rayCallback.m_hitNormalWorld.normalized();
+                result.m_distFraction = rayCallback.m_closestHitFraction * terrainFraction;
+                return const_cast<btRigidBody*>(body);
+            }
+        }
+
+        if (!hitsTerrain) {
+            return nullptr;
+        }
+
+        // btRaycastVehicle only checks the returned object for null
+        result.m_hitPointInWorld = end;
+        result.m_hitNormalInWorld = terrainNormal;
+        result.m_distFraction = terrainFraction;
+        return const_cast<VoxelTerrain*>(&terrain);
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <btBulletDynamicsCommon.h>
+
+#include "VoxelRaycaster.h"
+
+namespace tankwars {
+    class VoxelTerrain;
+
+    // Casts the wheel rays of a btRaycastVehicle against the voxels of the terrain instead of its collision
+    // shapes, so a wheel ray costs a few cells no matter how big the map or how many tanks there are.
+    // Everything but the terrain is still found by a ray test against the dynamics world.
+    class VoxelVehicleRaycaster : public btVehicleRaycaster {
+    public:
+        // The terrain must not move in memory while the raycaster is used
+        VoxelVehicleRaycaster(const VoxelTerrain& terrain, btDynamicsWorld* dynamicsWorld);
+
+        void* castRay(const btVector3& from, const btVector3& to, btVehicleRaycasterResult& result) override;
+
+    private:
+        const VoxelTerrain& terrain;
+        btDynamicsWorld* dynamicsWorld;
+        VoxelRaycaster terrainRaycaster;
+    };
+}
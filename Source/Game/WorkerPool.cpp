@@ -0,0 +1,104 @@
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace tankwars {
+    WorkerPool::WorkerPool(size_t numThreads) {
+        threads.reserve(numThreads);
+        for (size_t i = 0; i < numThreads; i++) {
+            threads.emplace_back(&WorkerPool::workerMain, this);
+        }
+    }
+
+    WorkerPool::~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            isShuttingDown = true;
+        }
+
+        taskAvailable.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    void WorkerPool::enqueue(std::function<void()> task) {
+        if (threads.empty()) {
+            task();
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+
+        taskAvailable.notify_one();
+    }
+
+    void WorkerPool::parallelFor(size_t count, const std::function<void(size_t)>& func) {
+        if (count == 0) {
+            return;
+        }
+
+        // The state is shared, because a worker may still look at it after the last call returned
+        struct SharedState {
+            std::atomic<size_t> nextIndex{ 0 };
+            std::atomic<size_t> numDone{ 0 };
+            std::mutex mutex;
+            std::condition_variable allDone;
+        };
+
+        auto state = std::make_shared<SharedState>();
+        auto run = [state, count, &func]() {
+            for (auto i = state->nextIndex++; i < count; i = state->nextIndex++) {
+                func(i);
+
+                if (++state->numDone == count) {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->allDone.notify_all();
+                }
+            }
+        };
+
+        auto numHelpers = std::min(threads.size(), count - 1);
+        for (size_t i = 0; i < numHelpers; i++) {
+            enqueue(run);
+        }
+
+        run();
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->allDone.wait(lock, [&]() { return state->numDone == count; });
+    }
+
+    size_t WorkerPool::getNumThreads() const {
+        return threads.size();
+    }
+
+    size_t WorkerPool::getDefaultThreadCount() {
+        auto hardwareThreads = static_cast<size_t>(std::thread::hardware_concurrency());
+        return hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+    }
+
+    void WorkerPool::workerMain() {
+        for (;;) {
+            std::function<void()> task;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                taskAvailable.wait(lock, [this]() { return isShuttingDown || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+
+            task();
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+namespace tankwars {
+    class WorkerPool {
+    public:
+        // A thread count of 0 means the work is done on the calling thread only
+        explicit WorkerPool(size_t numThreads = getDefaultThreadCount());
+        WorkerPool(const WorkerPool&) = delete;
+        ~WorkerPool();
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        // Runs the task on one of the worker threads at some point in the future
+        void enqueue(std::function<void()> task);
+
+        // Calls func(i) for every i in [0, count) on the workers and the calling thread
+        //   Returns once all calls have finished
+        void parallelFor(size_t count, const std::function<void(size_t)>& func);
+
+        size_t getNumThreads() const;
+
+        // One thread less than the hardware supports, since the main thread helps out
+        static size_t getDefaultThreadCount();
+
+    private:
+        void workerMain();
+
+        std::vector<std::thread> threads;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable taskAvailable;
+        bool isShuttingDown = false;
+    };
+}
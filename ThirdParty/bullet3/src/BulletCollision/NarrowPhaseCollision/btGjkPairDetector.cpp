@@ -100,7 +100,7 @@ void btGjkPairDetector::getClosestPointsNonVirtual(const ClosestPointInput& inpu
 	btScalar marginA = m_marginA;
 	btScalar marginB = m_marginB;
 
-	gNumGjkChecks++;
+	//gNumGjkChecks++; not counted, the narrowphase runs on several threads at once
 
 	//for CCD we don't use margins
 	if (m_ignoreMargin)
@@ -313,7 +313,7 @@ void btGjkPairDetector::getClosestPointsNonVirtual(const ClosestPointInput& inpu
 				// Penetration depth case.
 				btVector3 tmpPointOnA,tmpPointOnB;
 				
-				gNumDeepPenetrationChecks++;
+				//gNumDeepPenetrationChecks++; not counted, see gNumGjkChecks
 				m_cachedSeparatingAxis.setZero();
 
 				bool isValid2 = m_penetrationDepthSolver->calcPenDepth( 
@@ -158,7 +158,7 @@ void    btAlignedFreeInternal   (void* ptr,int line,char* filename)
 
 void*	btAlignedAllocInternal	(size_t size, int alignment)
 {
-	gNumAlignedAllocs++;
+	//gNumAlignedAllocs++; not counted, the narrowphase allocates on several threads at once
 	void* ptr;
 	ptr = sAlignedAllocFunc(size, alignment);
 //	printf("btAlignedAllocInternal %d, %x\n",size,ptr);
@@ -172,7 +172,7 @@ void	btAlignedFreeInternal	(void* ptr)
 		return;
 	}
 
-	gNumAlignedFree++;
+	//gNumAlignedFree++; not counted, the narrowphase frees on several threads at once
 //	printf("btAlignedFreeInternal %x\n",ptr);
 	sAlignedFreeFunc(ptr);
 }